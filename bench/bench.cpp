@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zappy/details/fmt.hpp>
+#include <zappy/details/pattern.hpp>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/aggregate.hpp>
+#include <zappy/sinks/file.hpp>
+#include <zappy/sinks/flight-recorder.hpp>
+#include <zappy/sinks/func.hpp>
+
+#include "alloc-count.hpp"
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+struct options {
+    std::size_t records = 200000;
+    unsigned max_threads = std::max(2u, std::thread::hardware_concurrency());
+    std::string output;
+    std::filesystem::path dir =
+        std::filesystem::temp_directory_path() / "zappy-bench";
+};
+
+struct result {
+    std::string group;
+    std::string name;
+    std::vector<std::pair<std::string, double>> values{};
+};
+
+auto ns_since(bench_clock::time_point t0) -> std::int64_t
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now() - t0)
+        .count();
+}
+
+// prevents the compiler from discarding benchmarked work
+std::atomic<std::size_t> sink_hole{0};
+void consume(std::size_t v) { sink_hole.fetch_add(v, std::memory_order_relaxed); }
+
+auto sample_msg() -> zappy::msg
+{
+    auto m = zappy::msg{zappy::level::warn,
+        "request finished with \"status\" 200\tafter retry",
+        {{"method", "GET"}, {"path", "/api/v1/items?id=42"},
+            {"status", "200"}, {"duration", "1.25ms"}}};
+    m.logger_name = "http";
+    return m;
+}
+
+void add_percentiles(result& r, std::vector<std::int64_t>& samples)
+{
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) {
+        auto i = std::size_t(q * double(samples.size() - 1));
+        return double(samples[i]);
+    };
+    r.values.emplace_back("p50_ns", at(0.5));
+    r.values.emplace_back("p99_ns", at(0.99));
+    r.values.emplace_back("p99.9_ns", at(0.999));
+    r.values.emplace_back("max_ns", double(samples.back()));
+}
+
+// latency of logger::log as seen by 1..N producer threads
+void bench_latency(options const& opt, std::vector<result>& results)
+{
+    for (std::size_t queue_size : {64, 1024, 16384}) {
+        for (auto threads = 1u; threads <= opt.max_threads; threads *= 2) {
+            auto core = zappy::make_core(queue_size,
+                {zappy::func_sink([](zappy::msg const& m) {
+                    consume(m.message.size());
+                }, {})});
+            auto lg = zappy::logger{"bench", core};
+
+            auto const per_thread = opt.records / threads;
+            auto samples = std::vector<std::vector<std::int64_t>>(threads);
+            auto ready = std::atomic<unsigned>{0};
+
+            auto producer = [&](unsigned idx) {
+                auto& s = samples[idx];
+                s.reserve(per_thread);
+                ++ready;
+                while (ready.load() < threads)
+                    std::this_thread::yield();
+                for (std::size_t i = 0; i < per_thread; ++i) {
+                    auto const t0 = bench_clock::now();
+                    lg.info("benchmark message",
+                        {{"thread", "producer"}, {"iteration", "12345"}});
+                    s.push_back(ns_since(t0));
+                }
+            };
+
+            auto const t0 = bench_clock::now();
+            auto pool = std::vector<std::thread>{};
+            for (auto i = 0u; i < threads; ++i)
+                pool.emplace_back(producer, i);
+            for (auto& t : pool)
+                t.join();
+            zappy::core::flush();
+            auto const elapsed = ns_since(t0);
+
+            auto all = std::vector<std::int64_t>{};
+            for (auto& s : samples)
+                all.insert(all.end(), s.begin(), s.end());
+
+            auto r = result{"latency",
+                "log/threads=" + std::to_string(threads) +
+                    "/queue=" + std::to_string(queue_size)};
+            r.values.emplace_back("threads", threads);
+            r.values.emplace_back("queue_size", double(queue_size));
+            r.values.emplace_back("records", double(all.size()));
+            add_percentiles(r, all);
+            r.values.emplace_back(
+                "records_per_sec", double(all.size()) * 1e9 / double(elapsed));
+            results.push_back(std::move(r));
+        }
+    }
+}
+
+// heap allocations per log call once the queue slots have been recycled,
+// with records on the global heap and in an arena
+void bench_allocations(options const& opt, std::vector<result>& results)
+{
+    auto run = [&](std::string const& name, zappy::core_options const& co,
+                   auto&& report) {
+        auto core = zappy::make_core(co, {zappy::func_sink([](zappy::msg const& m) {
+            consume(m.message.size() + m.attr_count());
+        }, {})});
+        auto lg = zappy::logger{"bench", core}.with_attributes(
+            {{"request_id", "0f8fad5b-d9cb-469f-a165-70867728950e"},
+                {"peer", "10.0.0.1:55312"}});
+
+        auto log = [&] {
+            lg.info("request finished after a rather long time in the backend",
+                {{"path", "/api/v1/items?id=42&expand=owner"},
+                    {"status", "200"}});
+        };
+        for (std::size_t i = 0; i < 2 * co.queue_size; ++i)
+            log();
+        zappy::core::flush();
+
+        auto const before = zappy_test::allocations.load();
+        for (std::size_t i = 0; i < opt.records; ++i)
+            log();
+        zappy::core::flush();
+        auto const n = zappy_test::allocations.load() - before;
+
+        auto r = result{"allocations", name};
+        r.values.emplace_back("records", double(opt.records));
+        r.values.emplace_back("allocations", double(n));
+        r.values.emplace_back("per_record", double(n) / double(opt.records));
+        report(r);
+        results.push_back(std::move(r));
+    };
+
+    run("log/heap", zappy::core_options{}, [](result&) {});
+
+    auto arena = zappy::arena_resource{};
+    run("log/arena", zappy::core_options{.memory = &arena}, [&](result& r) {
+        auto const st = arena.stats();
+        r.values.emplace_back("arena_allocations", double(st.allocations));
+        r.values.emplace_back("arena_in_use_bytes", double(st.in_use));
+        r.values.emplace_back("arena_reserved_bytes", double(st.reserved));
+    });
+}
+
+// end-to-end throughput: single producer until every record reached the sink
+void bench_sinks(options const& opt, std::vector<result>& results)
+{
+    std::filesystem::remove_all(opt.dir);
+    auto const pol = zappy::rotating_file_policy{
+        .max_size = 64 * 1024 * 1024, .max_count = 2};
+
+    auto run = [&](std::string const& name, zappy::sink_ptr sink) {
+        auto core = zappy::make_core(4096, {sink});
+        auto lg = zappy::logger{"bench", core};
+        auto const t0 = bench_clock::now();
+        for (std::size_t i = 0; i < opt.records; ++i)
+            lg.info("benchmark message",
+                {{"thread", "producer"}, {"iteration", "12345"}});
+        zappy::core::flush();
+        auto const elapsed = ns_since(t0);
+
+        auto r = result{"throughput", name};
+        r.values.emplace_back("records", double(opt.records));
+        r.values.emplace_back("elapsed_ns", double(elapsed));
+        r.values.emplace_back(
+            "records_per_sec", double(opt.records) * 1e9 / double(elapsed));
+        results.push_back(std::move(r));
+    };
+
+    run("null", zappy::func_sink([](zappy::msg const& m) {
+        consume(m.message.size());
+    }, {}));
+    run("json_file", zappy::rotating_json_file_sink(opt.dir / "bench.jsonl", pol));
+    run("text_file", zappy::rotating_text_file_sink(opt.dir / "bench.log", pol));
+
+    std::filesystem::remove_all(opt.dir);
+}
+
+template <typename F>
+void measure(std::vector<result>& results, std::string const& name,
+    std::size_t iterations, F&& f)
+{
+    for (std::size_t i = 0; i < iterations / 10; ++i)
+        f();
+    auto const t0 = bench_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        f();
+    auto const elapsed = ns_since(t0);
+
+    auto r = result{"micro", name};
+    r.values.emplace_back("iterations", double(iterations));
+    r.values.emplace_back("ns_per_op", double(elapsed) / double(iterations));
+    results.push_back(std::move(r));
+}
+
+void bench_micro(options const& opt, std::vector<result>& results)
+{
+    auto const m = sample_msg();
+    auto const n = opt.records * 5;
+    auto out = std::string{};
+
+    measure(results, "to_json", n, [&] {
+        zappy::to_json(out, m);
+        consume(out.size());
+    });
+    measure(results, "to_text", n, [&] {
+        zappy::to_text(out, m);
+        consume(out.size());
+    });
+
+    auto plain = zappy::ansi_fmt{false};
+    measure(results, "ansi_fmt::format/plain", n, [&] {
+        plain.format(out, m);
+        consume(out.size());
+    });
+    auto colored = zappy::ansi_fmt{true};
+    measure(results, "ansi_fmt::format/color", n, [&] {
+        colored.format(out, m);
+        consume(out.size());
+    });
+
+    auto const pattern = zappy::pattern_fmt{};
+    measure(results, "pattern_fmt::format/plain", n, [&] {
+        pattern.format(out, m);
+        consume(out.size());
+    });
+    auto const pattern_colored =
+        zappy::pattern_fmt{zappy::pattern_fmt::default_pattern, true};
+    measure(results, "pattern_fmt::format/color", n, [&] {
+        pattern_colored.format(out, m);
+        consume(out.size());
+    });
+
+    auto const clean = std::string(200, 'x');
+    auto escaped = clean;
+    for (std::size_t i = 7; i < escaped.size(); i += 23)
+        escaped[i] = i % 2 ? '"' : '\n';
+    auto w = [&](std::string_view sv) { out += sv; };
+    measure(results, "json_scramble/clean", n, [&] {
+        out.clear();
+        zappy::details::json_scramble(w, clean);
+        consume(out.size());
+    });
+    measure(results, "json_scramble/escaped", n, [&] {
+        out.clear();
+        zappy::details::json_scramble(w, escaped);
+        consume(out.size());
+    });
+
+    // recording at debug level, nothing triggers a dump
+    auto recorder = zappy::flight_recorder_sink(nullptr);
+    measure(results, "flight_recorder::write", n, [&] {
+        recorder->write(m);
+        consume(1);
+    });
+
+    // one group, two numeric attributes
+    auto aggregate = zappy::aggregate_sink(nullptr,
+        {.keys = {"method", "path"}, .values = {"status", "duration"}});
+    measure(results, "aggregate_sink::write", n, [&] {
+        aggregate->write(m);
+        consume(1);
+    });
+
+    auto const ts = zappy::clock::now();
+    measure(results, "timestamp", n, [&] {
+        char buf[27];
+        auto [p, _] = zappy::to_chars(buf, buf + sizeof(buf), ts);
+        consume(std::size_t(p - buf) + std::size_t(buf[18]));
+    });
+
+    // a dozen sinks, none of them taking debug records
+    auto sinks = std::vector<zappy::sink_ptr>{};
+    for (auto i = 0; i < 12; ++i)
+        sinks.push_back(zappy::func_sink(
+            [](zappy::msg const& m) { consume(m.message.size()); }, {}));
+    for (auto& s : sinks)
+        s->levels = zappy::levels(zappy::level::info);
+    auto core = zappy::make_core(64, std::span(sinks));
+    auto lg = zappy::logger{"bench", core};
+    measure(results, "logger::should_log/rejected", n, [&] {
+        consume(lg.should_log(zappy::level::debug));
+    });
+    measure(results, "logger::span/inactive", n, [&] {
+        auto s = lg.span("bench", {}, zappy::level::debug);
+        consume(s.active());
+    });
+    measure(results, "core::route", n, [&] {
+        consume(core->route(1, zappy::level::info).sinks);
+    });
+}
+
+void write_json(std::ostream& os, std::vector<result> const& results)
+{
+    auto str = [](std::string_view s) {
+        auto ret = std::string{"\""};
+        zappy::details::json_scramble(
+            [&](std::string_view sv) { ret += sv; }, s);
+        ret += '"';
+        return ret;
+    };
+
+    os << "{\n  \"timestamp\": " << str(zappy::to_string(zappy::clock::now()))
+       << ",\n  \"hardware_concurrency\": "
+       << std::thread::hardware_concurrency() << ",\n  \"results\": [";
+    auto first = true;
+    for (auto const& r : results) {
+        os << (first ? "\n" : ",\n") << "    {\"group\": " << str(r.group)
+           << ", \"name\": " << str(r.name);
+        for (auto const& [k, v] : r.values) {
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "%.6g", v);
+            os << ", " << str(k) << ": " << buf;
+        }
+        os << "}";
+        first = false;
+    }
+    os << "\n  ]\n}\n";
+}
+
+void usage()
+{
+    std::cout << "usage: zappy-bench [-n records] [-t max_threads] "
+                 "[-o output.json]\n";
+}
+
+} // namespace
+
+auto main(int argc, char** argv) -> int
+{
+    auto opt = options{};
+    for (int i = 1; i < argc; ++i) {
+        auto const arg = std::string_view(argv[i]);
+        auto const has_value = i + 1 < argc;
+        if (arg == "-n" && has_value)
+            opt.records = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "-t" && has_value)
+            opt.max_threads = unsigned(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-o" && has_value)
+            opt.output = argv[++i];
+        else {
+            usage();
+            return arg == "-h" || arg == "--help" ? 0 : 2;
+        }
+    }
+    if (!opt.records || !opt.max_threads) {
+        usage();
+        return 2;
+    }
+
+    auto results = std::vector<result>{};
+    bench_micro(opt, results);
+    bench_latency(opt, results);
+    bench_allocations(opt, results);
+    bench_sinks(opt, results);
+
+    if (opt.output.empty()) {
+        write_json(std::cout, results);
+    }
+    else {
+        auto f = std::ofstream{opt.output};
+        write_json(f, results);
+    }
+}
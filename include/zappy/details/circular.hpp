@@ -67,6 +67,21 @@ public:
             head_ = (head_ + 1) % capacity();
     }
 
+    // the slot the next push writes into, for filling it in place before
+    // commit_back
+    auto next() -> T& { return v_[tail_]; }
+
+    void commit_back()
+    {
+        if (v_.empty())
+            return;
+
+        tail_ = (tail_ + 1) % capacity();
+
+        if (tail_ == head_)
+            head_ = (head_ + 1) % capacity();
+    }
+
     auto front() const -> T const& { return v_[head_]; }
     auto front() -> T& { return v_[head_]; }
 
@@ -1,48 +1,339 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <initializer_list>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <span>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <vector>
+#include <zappy/details/filter.hpp>
+#include <zappy/details/level.hpp>
+#include <zappy/details/metrics.hpp>
+#include <zappy/details/span.hpp>
 
 namespace zappy {
 
-enum class level {
-    debug, // lowest priority messages for detailed app debugging
-    info,// info is the default logging priority
-    warn,// warning messages are more important than info
-    error,// high priority messages. i.e., If a system is running smoothly, it should not generate any error-level messages
-    critical,// highest priority, critical errors that require special attention
-};
-
 using clock = std::chrono::system_clock;
 
+// records and their attributes allocate from the memory resource of the
+// core they are queued in, see core_options
+using allocator_type = std::pmr::polymorphic_allocator<>;
+
 struct attribute {
-    std::string key;
-    std::string value;
+    using allocator_type = zappy::allocator_type;
+
+    std::pmr::string key;
+    std::pmr::string value;
     attribute(attribute const&) noexcept = default;
     attribute(attribute&&) noexcept = default;
-    attribute(std::string_view k, std::string_view v) noexcept
-        : key{k}
-        , value{v}
+    attribute(std::string_view k, std::string_view v,
+        allocator_type a = {}) noexcept
+        : key{k, a}
+        , value{v, a}
+    {
+    }
+    attribute(attribute const& o, allocator_type a)
+        : key{o.key, a}
+        , value{o.value, a}
+    {
+    }
+    attribute(attribute&& o, allocator_type a)
+        : key{std::move(o.key), a}
+        , value{std::move(o.value), a}
     {
     }
     auto operator=(attribute const&) -> attribute& = default;
     auto operator=(attribute&&) -> attribute& = default;
 };
 
+// attribute_view refers to a key and a value owned by the caller
+struct attribute_view {
+    std::string_view key;
+    std::string_view value;
+    attribute_view(std::string_view k, std::string_view v) noexcept
+        : key{k}
+        , value{v}
+    {
+    }
+    attribute_view(attribute const& a) noexcept
+        : key{a.key}
+        , value{a.value}
+    {
+    }
+};
+
+namespace details {
+
+
+// attr_list holds the attributes of a record: up to inline_count of them,
+// with up to inline_bytes of key and value characters, are stored inside the
+// record, larger lists spill to the record's memory resource. Elements are
+// read as attribute_view; spilled storage is kept when the list is cleared
+struct attr_list {
+    using allocator_type = zappy::allocator_type;
+
+    static constexpr std::size_t inline_count = 4;
+    static constexpr std::size_t inline_bytes = 192;
+
+private:
+    struct entry {
+        std::uint32_t key_off;
+        std::uint32_t key_len;
+        std::uint32_t value_off;
+        std::uint32_t value_len;
+    };
+
+    std::size_t size_ = 0;
+    std::size_t used_ = 0;  // characters in use
+    bool spilled_ = false; // characters live in heap_
+    std::array<entry, inline_count> entries_;
+    std::array<char, inline_bytes> chars_;
+    std::pmr::vector<entry> more_; // entries past inline_count
+    std::pmr::vector<char> heap_;
+
+    auto chars() const -> char const*
+    {
+        return spilled_ ? heap_.data() : chars_.data();
+    }
+
+    auto at(std::size_t i) const -> entry const&
+    {
+        return i < inline_count ? entries_[i] : more_[i - inline_count];
+    }
+
+    // appends characters, which must not refer to the list itself
+    auto store(std::string_view sv) -> std::uint32_t
+    {
+        auto const off = used_;
+        auto const need = used_ + sv.size();
+        if (!spilled_ && need > inline_bytes) {
+            if (heap_.size() < need)
+                heap_.resize(std::max(need, 2 * inline_bytes));
+            std::memcpy(heap_.data(), chars_.data(), used_);
+            spilled_ = true;
+        }
+        else if (spilled_ && need > heap_.size()) {
+            heap_.resize(std::max(need, 2 * heap_.size()));
+        }
+        if (!sv.empty())
+            std::memcpy((spilled_ ? heap_.data() : chars_.data()) + off,
+                sv.data(), sv.size());
+        used_ = need;
+        return std::uint32_t(off);
+    }
+
+    // takes over the content of o, handing it this list's spilled storage
+    void take(attr_list& o) noexcept
+    {
+        size_ = o.size_;
+        used_ = o.used_;
+        spilled_ = o.spilled_;
+        std::copy_n(o.entries_.begin(), std::min(size_, inline_count),
+            entries_.begin());
+        if (!spilled_)
+            std::memcpy(chars_.data(), o.chars_.data(), used_);
+        more_.swap(o.more_);
+        heap_.swap(o.heap_);
+        o.clear();
+    }
+
+    void copy(attr_list const& o)
+    {
+        clear();
+        for (auto a : o)
+            emplace_back(a.key, a.value);
+    }
+
+public:
+    struct iterator {
+        using iterator_category = std::input_iterator_tag;
+        using value_type = attribute_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = attribute_view;
+
+        attr_list const* list = nullptr;
+        std::size_t i = 0;
+
+        auto operator*() const -> attribute_view { return (*list)[i]; }
+        auto operator++() -> iterator&
+        {
+            ++i;
+            return *this;
+        }
+        auto operator++(int) -> iterator
+        {
+            auto ret = *this;
+            ++i;
+            return ret;
+        }
+        auto operator==(iterator const& o) const -> bool { return i == o.i; }
+    };
+
+    attr_list() = default;
+    explicit attr_list(allocator_type a)
+        : more_{a}
+        , heap_{a}
+    {
+    }
+    attr_list(attr_list const& o)
+        : attr_list(o, allocator_type{})
+    {
+    }
+    attr_list(attr_list const& o, allocator_type a)
+        : more_{a}
+        , heap_{a}
+    {
+        copy(o);
+    }
+    attr_list(attr_list&& o) noexcept
+        : more_{o.get_allocator()}
+        , heap_{o.get_allocator()}
+    {
+        take(o);
+    }
+    attr_list(attr_list&& o, allocator_type a)
+        : more_{a}
+        , heap_{a}
+    {
+        if (a == o.get_allocator())
+            take(o);
+        else
+            copy(o);
+    }
+
+    auto operator=(attr_list const& o) -> attr_list&
+    {
+        if (this != &o)
+            copy(o);
+        return *this;
+    }
+    // swaps spilled storage with o when both use the same resource, so that
+    // recycled records keep their capacity
+    auto operator=(attr_list&& o) -> attr_list&
+    {
+        if (this == &o)
+            return *this;
+        if (get_allocator() == o.get_allocator())
+            take(o);
+        else
+            copy(o);
+        return *this;
+    }
+
+    auto get_allocator() const -> allocator_type
+    {
+        return heap_.get_allocator();
+    }
+
+    auto size() const -> std::size_t { return size_; }
+    auto empty() const -> bool { return size_ == 0; }
+
+    auto operator[](std::size_t i) const -> attribute_view
+    {
+        auto const& e = at(i);
+        auto const c = chars();
+        return {std::string_view(c + e.key_off, e.key_len),
+            std::string_view(c + e.value_off, e.value_len)};
+    }
+
+    auto begin() const -> iterator { return {this, 0}; }
+    auto end() const -> iterator { return {this, size_}; }
+
+    void clear() noexcept
+    {
+        size_ = 0;
+        used_ = 0;
+        spilled_ = false;
+        more_.clear();
+    }
+
+    void emplace_back(std::string_view key, std::string_view value)
+    {
+        auto e = entry{};
+        e.key_len = std::uint32_t(key.size());
+        e.key_off = store(key);
+        e.value_len = std::uint32_t(value.size());
+        e.value_off = store(value);
+        if (size_ < inline_count)
+            entries_[size_] = e;
+        else
+            more_.push_back(e);
+        ++size_;
+    }
+
+    void push_back(attribute_view a) { emplace_back(a.key, a.value); }
+};
+
+// attr_context holds the attributes a logger adds to all of its records,
+// escaped and rendered once per output format; records share it instead of
+// copying the attributes, formatters splice the fragments as they are
+struct attr_context {
+    attr_list attributes;
+    std::string json; // ,"key":"value"...
+    std::string text; //  | key=value...
+    std::string ansi; // text with the default ansi_fmt colors
+};
+
+} // namespace details
+
 struct msg {
+    using allocator_type = zappy::allocator_type;
+
     clock::time_point timestamp;
-    std::string logger_name;
+    std::pmr::string logger_name;
     zappy::level level = zappy::level::info;
-    std::string message;
-    std::vector<attribute> attributes;
+    std::pmr::string message;
+    details::attr_list attributes;
+    // attributes of the logger, following the record's own attributes
+    std::shared_ptr<details::attr_context const> context;
+    // id of the logger name in the core the record is queued in, 0 if the
+    // record did not come from a logger of that core
+    std::uint32_t logger_id = 0;
+    // index of the thread that logged the record, see details::span_ids;
+    // set by core::write if 0
+    std::uint32_t thread = 0;
 
     msg() {}
-    msg(zappy::level l, std::string const& m)
+    explicit msg(allocator_type a)
+        : logger_name{a}
+        , message{a}
+        , attributes{a}
+    {
+    }
+    msg(msg const& o, allocator_type a)
+        : timestamp{o.timestamp}
+        , logger_name{o.logger_name, a}
+        , level{o.level}
+        , message{o.message, a}
+        , attributes{o.attributes, a}
+        , context{o.context}
+        , logger_id{o.logger_id}
+        , thread{o.thread}
+    {
+    }
+    msg(msg&& o, allocator_type a)
+        : timestamp{o.timestamp}
+        , logger_name{std::move(o.logger_name), a}
+        , level{o.level}
+        , message{std::move(o.message), a}
+        , attributes{std::move(o.attributes), a}
+        , context{std::move(o.context)}
+        , logger_id{o.logger_id}
+        , thread{o.thread}
+    {
+    }
+    msg(zappy::level l, std::string_view m)
         : timestamp{clock::now()}
         , level{l}
         , message{m}
@@ -52,30 +343,32 @@ struct msg {
     msg(msg&&) = default;
 
     template <typename AttrIter>
-    msg(zappy::level l, std::string const& m, AttrIter attrs_begin,
+    msg(zappy::level l, std::string_view m, AttrIter attrs_begin,
         AttrIter attrs_end)
         : timestamp{clock::now()}
         , level{l}
         , message{m}
-        , attributes{attrs_begin, attrs_end}
     {
+        for (; attrs_begin != attrs_end; ++attrs_begin)
+            attributes.emplace_back(attrs_begin->key, attrs_begin->value);
     }
 
-    msg(zappy::level l, std::string const& m, attribute const& a)
+    msg(zappy::level l, std::string_view m, attribute const& a)
         : timestamp{clock::now()}
         , level{l}
         , message{m}
-        , attributes{&a, (&a) + 1}
     {
+        attributes.push_back(a);
     }
 
-    msg(zappy::level l, std::string const& m,
-        std::initializer_list<attribute> aa)
+    msg(zappy::level l, std::string_view m,
+        std::initializer_list<attribute_view> aa)
         : timestamp{clock::now()}
         , level{l}
         , message{m}
-        , attributes{aa.begin(), aa.end()}
     {
+        for (auto const& a : aa)
+            attributes.push_back(a);
     }
 
     auto operator=(msg const&) -> msg& = default;
@@ -83,28 +376,144 @@ struct msg {
 
     auto add_attr(attribute&& a) -> msg&
     {
-        attributes.push_back(std::move(a));
+        attributes.push_back(a);
         return *this;
     }
     auto add_attr(std::string_view key, std::string_view value) -> msg&
     {
-        attributes.push_back(attribute{std::string(key), std::string(value)});
+        attributes.emplace_back(key, value);
         return *this;
     }
+
+    // overwrites the record, reusing the capacity of its strings and of its
+    // spilled attributes
+    void assign(clock::time_point ts, zappy::level l, std::string_view name,
+        std::string_view m, std::span<attribute_view const> aa,
+        std::shared_ptr<details::attr_context const> const& ctx)
+    {
+        timestamp = ts;
+        level = l;
+        logger_name.assign(name);
+        message.assign(m);
+        attributes.clear();
+        for (auto const& a : aa)
+            attributes.push_back(a);
+        context = ctx;
+    }
+
+    // visits the record's own attributes, then the context attributes
+    template <typename F> void for_each_attr(F&& f) const
+    {
+        for (auto a : attributes)
+            f(a);
+        if (context)
+            for (auto a : context->attributes)
+                f(a);
+    }
+
+    auto get_allocator() const -> allocator_type
+    {
+        return message.get_allocator();
+    }
+
+    auto attr_count() const -> std::size_t
+    {
+        return attributes.size() + (context ? context->attributes.size() : 0);
+    }
 };
 
-using level_filter = std::function<bool(level)>;
+// level_filter is a set of levels kept in an atomic bit mask, so that it can
+// be changed with set() or assignment while other threads are logging.
+//
+// A predicate is evaluated once per level when it is converted, the filter
+// keeps the result: a predicate whose answer depends on state that changes
+// later is not consulted again, assign a new filter instead.
+//
+// A default-constructed filter, like one made from an empty std::function,
+// lets every level through but tests false, so that switches such as
+// core::auto_flush can be turned off with `= {}`
+struct level_filter {
+private:
+    static constexpr std::uint8_t all_levels = 0x1f;
+    static constexpr std::uint8_t unset = 0x80; // default-constructed
+    std::atomic<std::uint8_t> mask_{all_levels | unset};
+
+    auto raw() const noexcept -> std::uint8_t
+    {
+        return mask_.load(std::memory_order_relaxed);
+    }
+
+public:
+    level_filter() = default;
+    level_filter(level_filter const& o) noexcept
+        : mask_{o.raw()}
+    {
+    }
+
+    template <typename Pred>
+        requires(!std::is_same_v<std::remove_cvref_t<Pred>, level_filter> &&
+                 std::is_invocable_r_v<bool, Pred const&, level>)
+    level_filter(Pred const& pred)
+    {
+        if constexpr (std::is_constructible_v<bool, Pred const&>)
+            if (!static_cast<bool>(pred))
+                return; // empty std::function
+        auto m = std::uint8_t{0};
+        for (auto l = 0; l <= int(level::critical); ++l)
+            if (pred(level(l)))
+                m |= std::uint8_t(1u << l);
+        mask_.store(m, std::memory_order_relaxed);
+    }
+
+    static auto from_mask(std::uint8_t m) -> level_filter
+    {
+        auto f = level_filter{};
+        f.mask_.store(m & all_levels, std::memory_order_relaxed);
+        return f;
+    }
+
+    static auto none() -> level_filter { return from_mask(0); }
+
+    auto operator=(level_filter const& o) noexcept -> level_filter&
+    {
+        set(o);
+        return *this;
+    }
+
+    void set(level_filter const& o) noexcept
+    {
+        mask_.store(o.raw(), std::memory_order_relaxed);
+        details::filter_generation.fetch_add(1, std::memory_order_release);
+    }
+
+    auto mask() const noexcept -> std::uint8_t { return raw() & all_levels; }
+
+    // false for a default-constructed filter
+    explicit operator bool() const noexcept { return !(raw() & unset); }
+
+    auto all() const noexcept -> bool { return mask() == all_levels; }
+
+    auto operator()(level v) const noexcept -> bool
+    {
+        return (mask() >> unsigned(v)) & 1u;
+    }
+};
 
 inline auto levels(level min_v, level max_v = level::critical) -> level_filter
 {
-    return [min_v, max_v](level v) -> bool { 
-        return v >= min_v && v <= max_v; 
-    };
+    auto m = std::uint8_t{0};
+    for (auto l = int(min_v); l <= int(max_v); ++l)
+        m |= std::uint8_t(1u << l);
+    return level_filter::from_mask(m);
 }
 
+struct core;
+
 // sink interface
 struct sink {
     level_filter levels;
+    record_filter filter; // applied to the records levels lets through
+    details::sink_counters counters;
     sink(level_filter&& f = {})
         : levels{std::move(f)}
     {
@@ -112,10 +521,48 @@ struct sink {
     virtual ~sink() {}
     virtual void write(msg const&) = 0;
     virtual void flush() = 0;
+    // makes what was flushed durable, as far as the sink can; called by
+    // core::sync after flush
+    virtual void sync() {}
+    // for sinks that complete sync on a thread of their own: waits until the
+    // syncs started so far are done, false if the deadline passed first
+    virtual auto wait_synced(std::chrono::steady_clock::time_point) -> bool
+    {
+        return true;
+    }
+
+    // called when the sink is connected to or disconnected from a core
+    virtual void attach(core&) {}
+    virtual void detach(core&) {}
 
-    auto should_log(level v) const -> bool { return !levels || levels(v); }
+    auto should_log(level v) const -> bool { return levels(v); }
+    // should_log and filter together, for records not routed by a core
+    auto accepts(msg const& m) const -> bool
+    {
+        return levels(m.level) && filter.matches(m);
+    }
+    auto metrics() const -> sink_metrics { return counters.snapshot(); }
 };
 using sink_ptr = std::shared_ptr<sink>;
 using sinks_init_list = std::initializer_list<sink_ptr>;
 
+namespace details {
+
+// writes a record into a sink, accounting for it in the sink counters
+inline void deliver(sink& s, msg const& m)
+{
+    auto _ = latency_scope{s.counters.write_latency};
+    s.write(m);
+    s.counters.records.add();
+}
+
+// flushes a sink, accounting for it in the sink counters
+inline void flush_sink(sink& s)
+{
+    auto _ = latency_scope{s.counters.flush_latency};
+    s.flush();
+}
+
+} // namespace details
+
 } // namespace zappy
\ No newline at end of file
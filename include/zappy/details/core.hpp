@@ -1,38 +1,199 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <memory_resource>
+#include <mutex>
 #include <span>
+#include <string>
 #include <vector>
 #include <zappy/details/common.hpp>
+#include <zappy/details/memory.hpp>
+#include <zappy/details/metrics.hpp>
 #include <zappy/details/queue.hpp>
+#include <zappy/details/routing.hpp>
+#include <zappy/details/throttle.hpp>
 #include <zappy/details/worker.hpp>
 
 namespace zappy {
 
+struct core_options {
+    // records are queued in one lane per level class, each with its own
+    // capacity, so that a flood of debug records can not block an error
+    std::size_t queue_size = 1024;     // debug and info
+    std::size_t warn_queue_size = 256;  // warn
+    std::size_t error_queue_size = 256; // error and critical
+    // records taken from the lanes per round; within a round they reach the
+    // sinks in timestamp order
+    std::size_t drain_batch = 256;
+    // the queues and the records in them allocate from this resource, it
+    // must outlive the core
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource();
+};
+
 // core provides a thread-save queue for messages which are periodically and
 // asynronosly pulled into sinks.
 struct core {
 private:
-    details::queue<msg> mq;
-    std::vector<sink_ptr> const sinks;
+    // lanes in priority order: error and critical, warn, debug and info
+    static constexpr std::size_t lane_count = 3;
+
+    allocator_type alloc_;
+    std::array<details::queue<msg>, lane_count> lanes_;
+    // replaced as a whole by add_sink and remove_sink (under sink_mtx_), so
+    // that readers only ever take a snapshot
+    std::atomic<std::shared_ptr<std::vector<sink_ptr> const>> sinks_;
+    std::atomic<std::size_t> sink_count_{0};
+    std::atomic<std::uint64_t> sinks_version_{0};
+    details::route_table routes_;
+    details::counter enqueued_;
+    details::counter dropped_;
 
     inline static std::vector<core*> instances;
     inline static std::mutex sink_mtx_;
-    static void want_thread();
+    // records swapped into the queue slots by drain, they keep the capacity
+    // of drained records going back to the producers; guarded by sink_mtx_
+    std::array<std::pmr::vector<msg>, lane_count> staged_;
+
+    // flush requests are numbered, the worker publishes the number of the
+    // latest request covered by a completed flush
+    inline static std::atomic<std::uint64_t> flush_requested_{0};
+    inline static std::uint64_t flush_completed_ = 0;
+    // sync requests likewise, every flush covering one syncs the sinks
+    inline static std::atomic<std::uint64_t> sync_requested_{0};
+    inline static std::uint64_t sync_completed_ = 0;
+    inline static details::latency_recorder sync_wait_;
+    inline static std::mutex flush_mtx_;
+    inline static std::condition_variable flush_cv_;
+
+    static auto worker() -> details::worker&;
+    static void background_flush();
+    // syncs the sinks of all cores; must be called with sink_mtx_ locked
+    static void sync_sinks();
+    // waits for the sinks of all cores that complete syncs later, see
+    // sink::wait_synced; must be called without sink_mtx_
+    static auto wait_synced(std::chrono::steady_clock::time_point deadline)
+        -> bool;
+
+    static auto lane_of(level l) -> std::size_t
+    {
+        return l >= level::error ? 0 : l == level::warn ? 1 : 2;
+    }
+
+    // delivers all queued records and the throttle summaries to the sinks;
+    // must be called with sink_mtx_ locked
+    void drain();
+    // delivers m to the sinks in list that take it
+    void dispatch(std::vector<sink_ptr> const& list, msg const& m);
+
+    // changes whenever a filter or the sink list changes
+    auto epoch() const -> std::uint64_t
+    {
+        return details::filter_generation.load(std::memory_order_acquire) +
+               sinks_version_.load(std::memory_order_acquire);
+    }
+
+    // routes of the records of level l from logger_name to the sinks in
+    // list, as far as the filters can tell from the name and the level; a
+    // null logger_name leaves filters to the individual records
+    auto route_of(std::vector<sink_ptr> const& list,
+        std::string const* logger_name, level l) const -> details::route_masks;
 
 public:
     level_filter levels;
+    record_filter filter; // applied to the records levels lets through
+    zappy::throttle throttling;
+
+    // records matching auto_flush make the logger request a background flush;
+    // assigning {} turns it off
     inline static level_filter auto_flush =
         zappy::levels(level::error, level::critical);
+    // records matching auto_sync make the logger request a background flush
+    // followed by a sync, see sync; assigning {} turns it off
+    inline static level_filter auto_sync =
+        zappy::levels(level::critical, level::critical);
 
     template <typename SinkIter>
-    core(std::size_t mq_size, SinkIter begin, SinkIter end);
+    core(core_options const& opts, SinkIter begin, SinkIter end);
+    template <typename SinkIter>
+    core(std::size_t mq_size, SinkIter begin, SinkIter end)
+        : core(core_options{.queue_size = mq_size}, begin, end)
+    {
+    }
     ~core();
 
     auto should_log(level v) const -> bool;
 
-    void write(msg&& m);
+    // queues the record, returns false if it was filtered out or dropped;
+    // logger_id is the id intern returned for the record's logger name
+    auto write(msg&& m, std::uint32_t logger_id = 0) -> bool;
 
+    // builds the record in a recycled queue slot, so that logging does not
+    // allocate once the slots have grown to the usual record size
+    auto write(level l, std::string_view logger_name, std::string_view message,
+        std::span<attribute_view const> attrs,
+        std::shared_ptr<details::attr_context const> const& context,
+        std::uint32_t logger_id = 0) -> bool;
+
+    // id of a logger name in the routing table of this core, 0 if the table
+    // is full
+    auto intern(std::string_view logger_name) -> std::uint32_t
+    {
+        return routes_.intern(logger_name);
+    }
+
+    // bit masks of the sinks, by position in sinks(), that take records of
+    // the logger at level l; a single lookup once the route is computed.
+    // Only the first 64 sinks are routed
+    auto route(std::uint32_t logger_id, level l) -> details::route_masks;
+
+    // drains all cores and flushes their sinks on the calling thread
     static void flush();
+
+    // asks the background worker to flush all cores and returns immediately
+    static void request_flush();
+
+    // asks the background worker to flush all cores and waits until the
+    // records queued before the call reached the sinks, returns false if the
+    // deadline passed first
+    static auto flush(std::chrono::steady_clock::time_point deadline) -> bool;
+
+    // drains and flushes all cores and syncs their sinks on the calling
+    // thread
+    static void sync();
+
+    // asks the background worker to flush and sync all cores and returns
+    // immediately
+    static void request_sync();
+
+    // asks the background worker to flush and sync all cores and waits
+    // until the records queued before the call are durable in the sinks
+    // that support it, returns false if the deadline passed first. Callers
+    // waiting at the same time share one sync of every sink; sinks that
+    // sync on a thread of their own, like async_sink, are waited for as well
+    static auto sync(std::chrono::steady_clock::time_point deadline) -> bool;
+
+    // connects a sink while logging is running, it receives the records
+    // drained from then on
+    void add_sink(sink_ptr s);
+
+    // disconnects a sink while logging is running, after delivering the
+    // records queued so far; once this returns the sink receives no more
+    // records and has been flushed and detached.
+    // Must not be called from within a sink
+    auto remove_sink(sink_ptr const& s) -> bool;
+
+    auto sinks() const -> std::shared_ptr<std::vector<sink_ptr> const>
+    {
+        return sinks_.load(std::memory_order_acquire);
+    }
+
+    // snapshot of the pipeline counters of this core and its sinks
+    auto metrics() const -> core_metrics;
 };
 
 inline auto make_core(std::size_t mq_size,
@@ -47,14 +208,46 @@ inline auto make_core(std::size_t mq_size, std::span<sink_ptr> sinks)
     return std::make_shared<core>(mq_size, sinks.begin(), sinks.end());
 }
 
+inline auto make_core(core_options const& opts,
+    std::initializer_list<sink_ptr> sinks) -> std::shared_ptr<core>
+{
+    return std::make_shared<core>(opts, sinks.begin(), sinks.end());
+}
+
+inline auto make_core(core_options const& opts, std::span<sink_ptr> sinks)
+    -> std::shared_ptr<core>
+{
+    return std::make_shared<core>(opts, sinks.begin(), sinks.end());
+}
+
 template <typename SinkIter>
-inline core::core(std::size_t mq_size, SinkIter begin, SinkIter end)
-    : mq{mq_size}
-    , sinks{begin, end}
+inline core::core(core_options const& opts, SinkIter begin, SinkIter end)
+    : alloc_{opts.memory}
+    , lanes_{{{opts.error_queue_size, opts.memory},
+          {opts.warn_queue_size, opts.memory},
+          {opts.queue_size, opts.memory}}}
+    , sinks_{std::make_shared<std::vector<sink_ptr> const>(begin, end)}
+    // with the resource of the slots they are swapped with, a move
+    // assignment would keep the default one
+    , staged_{{std::pmr::vector<msg>(alloc_), std::pmr::vector<msg>(alloc_),
+          std::pmr::vector<msg>(alloc_)}}
 {
-    want_thread();
+    auto stage = [&](std::size_t i, std::size_t lane_size) {
+        auto const n = std::min(std::max<std::size_t>(opts.drain_batch, 1),
+            lane_size);
+        staged_[i].resize(n);
+    };
+    stage(0, opts.error_queue_size);
+    stage(1, opts.warn_queue_size);
+    stage(2, opts.queue_size);
+
+    worker();
     auto _ = std::unique_lock(sink_mtx_);
     instances.push_back(this);
+    auto const list = sinks();
+    sink_count_.store(list->size(), std::memory_order_relaxed);
+    for (auto&& s : *list)
+        s->attach(*this);
 }
 
 inline core::~core()
@@ -63,53 +256,374 @@ inline core::~core()
     auto it = std::find(instances.begin(), instances.end(), this);
     if (it != instances.end()) {
         instances.erase(it);
-        msg m;
-        while (mq.try_pop(m))
-            for (auto&& s : sinks)
-                if (s->should_log(m.level))
-                    s->write(m);
+        drain();
+        throttling.take_summaries(
+            [&](msg const& m) { dispatch(*sinks(), m); }, true);
+        for (auto&& s : *sinks())
+            s->detach(*this);
     }
 }
 
 inline auto core::should_log(level v) const -> bool
 {
-    return !sinks.empty() && (!levels || levels(v));
+    return sink_count_.load(std::memory_order_relaxed) && levels(v);
+}
+
+inline auto core::write(msg&& m, std::uint32_t logger_id) -> bool
+{
+    m.logger_id = logger_id;
+    if (!should_log(m.level))
+        return false;
+    if (!m.thread)
+        m.thread = details::span_ids::get().thread;
+    if (!throttling.admit(m)) {
+        dropped_.add();
+        return false;
+    }
+    lanes_[lane_of(m.level)].push(std::move(m));
+    enqueued_.add();
+    return true;
+}
+
+inline auto core::write(level l, std::string_view logger_name,
+    std::string_view message, std::span<attribute_view const> attrs,
+    std::shared_ptr<details::attr_context const> const& context,
+    std::uint32_t logger_id) -> bool
+{
+    if (!should_log(l))
+        return false;
+
+    if (throttling.active()) {
+        // the throttle may drop the record before it takes a slot
+        auto m = msg{alloc_};
+        m.assign(clock::now(), l, logger_name, message, attrs, context);
+        return write(std::move(m), logger_id);
+    }
+
+    auto const ts = clock::now();
+    lanes_[lane_of(l)].push_in_place([&](msg& slot) {
+        slot.assign(ts, l, logger_name, message, attrs, context);
+        slot.logger_id = logger_id;
+        slot.thread = details::span_ids::get().thread;
+    });
+    enqueued_.add();
+    return true;
+}
+
+// each round takes up to a batch of records from every lane, higher
+// priority lanes first, and merges them by timestamp; a record waits behind at
+// most one batch of lower priority records, however long their backlog.
+// Draining stops once as many records as were queued on entry have been
+// delivered, so that busy producers can not keep it going forever
+inline void core::drain()
+{
+    throttling.take_summaries([&](msg const& m) { dispatch(*sinks(), m); });
+
+    auto count = std::array<std::size_t, lane_count>{};
+    auto pos = std::array<std::size_t, lane_count>{};
+    auto budget = std::size_t{0};
+    for (auto const& lane : lanes_)
+        budget += lane.size();
+    while (budget) {
+        auto total = std::size_t{0};
+        for (std::size_t i = 0; i < lane_count; ++i) {
+            auto& st = staged_[i];
+            count[i] = 0;
+            pos[i] = 0;
+            while (count[i] < st.size() && lanes_[i].try_pop(st[count[i]]))
+                ++count[i];
+            total += count[i];
+        }
+        if (!total)
+            return;
+        budget -= std::min(budget, total);
+
+        auto const list = sinks();
+        for (; total; --total) {
+            auto next = lane_count;
+            for (std::size_t i = 0; i < lane_count; ++i)
+                if (pos[i] < count[i] &&
+                    (next == lane_count ||
+                        staged_[i][pos[i]].timestamp <
+                            staged_[next][pos[next]].timestamp))
+                    next = i;
+            dispatch(*list, staged_[next][pos[next]++]);
+        }
+    }
 }
 
-inline void core::write(msg&& m)
+inline void core::dispatch(std::vector<sink_ptr> const& list, msg const& m)
 {
-    if (should_log(m.level))
-        mq.push(std::move(m));
+    if (list.size() <= details::route_table::max_sinks) {
+        auto const r = route(m.logger_id, m.level);
+        for (auto mask = r.sinks; mask; mask &= mask - 1)
+            details::deliver(*list[std::countr_zero(mask)], m);
+        if (!r.check || !filter.matches(m))
+            return;
+        for (auto mask = r.check & ~r.sinks; mask; mask &= mask - 1) {
+            auto& s = *list[std::countr_zero(mask)];
+            if (s.filter.matches(m))
+                details::deliver(s, m);
+        }
+        return;
+    }
+    if (!levels(m.level) || !filter.matches(m))
+        return;
+    for (auto&& s : list)
+        if (s->accepts(m))
+            details::deliver(*s, m);
 }
 
 inline void core::flush()
 {
-    msg m;
     auto _ = std::unique_lock(sink_mtx_);
     for (auto& it : instances) {
-        while (it->mq.try_pop(m))
-            for (auto&& s : it->sinks)
-                if (s->should_log(m.level))
-                    s->write(m);
+        it->drain();
 
-        for (auto&& s : it->sinks)
-            s->flush();
+        for (auto&& s : *it->sinks())
+            details::flush_sink(*s);
     }
 }
 
-inline void core::want_thread()
+inline auto core::metrics() const -> core_metrics
 {
-    static bool core_thread_created = false;
-    if (core_thread_created)
-        return;
+    auto ret = core_metrics{
+        .enqueued = enqueued_.load(),
+        .dropped = dropped_.load(),
+    };
+    // summed over the lanes, but for the high-water mark
+    for (auto const& lane : lanes_) {
+        auto const q = lane.stats();
+        ret.queue_size += q.size;
+        ret.queue_capacity += q.capacity;
+        ret.queue_high_water = std::max(ret.queue_high_water, q.high_water);
+        ret.blocked_pushes += q.blocked_pushes;
+        ret.blocked_time += q.blocked_time;
+    }
+    ret.sync_wait = sync_wait_.snapshot();
+    auto const list = sinks();
+    ret.sinks.reserve(list->size());
+    for (auto&& s : *list)
+        ret.sinks.push_back(s->metrics());
+    return ret;
+}
+
+inline auto core::route_of(std::vector<sink_ptr> const& list,
+    std::string const* logger_name, level l) const -> details::route_masks
+{
+    using details::tri;
+    auto partial = [&](record_filter const& f) {
+        return logger_name ? f.partial(*logger_name, l)
+               : f.empty() ? tri::yes
+                           : tri::maybe;
+    };
+
+    auto ret = details::route_masks{};
+    auto const own = levels(l) ? partial(filter) : tri::no;
+    if (own == tri::no)
+        return ret;
+    auto const n = std::min(list.size(), details::route_table::max_sinks);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (!list[i]->should_log(l))
+            continue;
+        auto const t = partial(list[i]->filter);
+        if (t == tri::no)
+            continue;
+        auto const bit = std::uint64_t{1} << i;
+        if (own == tri::yes && t == tri::yes)
+            ret.sinks |= bit;
+        else
+            ret.check |= bit;
+    }
+    return ret;
+}
+
+inline auto core::route(std::uint32_t logger_id, level l)
+    -> details::route_masks
+{
+    auto row = routes_.find(logger_id);
+    if (!row)
+        return route_of(*sinks(), nullptr, l);
+
+    if (row->epoch.load(std::memory_order_acquire) != epoch()) {
+        // rebuilds are serialized and each reads the epoch again under the
+        // lock, so a row is never stamped with an epoch newer than the sink
+        // list it was built from. The epoch is read before the sink list, a
+        // list newer than e only makes the row look stale again
+        auto _ = std::unique_lock(routes_.rebuild_mux);
+        auto const e = epoch();
+        if (row->epoch.load(std::memory_order_relaxed) != e) {
+            auto const list = sinks();
+            constexpr auto n = details::route_table::level_count;
+            auto masks = std::array<details::route_masks, n>{};
+            for (std::size_t i = 0; i < masks.size(); ++i)
+                masks[i] = route_of(*list, &row->logger_name, level(i));
+
+            auto const seq = row->seq.load(std::memory_order_relaxed);
+            row->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (std::size_t i = 0; i < masks.size(); ++i) {
+                row->sinks[i].store(masks[i].sinks, std::memory_order_relaxed);
+                row->check[i].store(masks[i].check, std::memory_order_relaxed);
+            }
+            row->seq.store(seq + 2, std::memory_order_release);
+            row->epoch.store(e, std::memory_order_release);
+        }
+    }
+
+    // both masks of a level come from the same rebuild
+    auto const i = std::size_t(l);
+    while (true) {
+        auto const seq = row->seq.load(std::memory_order_acquire);
+        auto const ret = details::route_masks{
+            row->sinks[i].load(std::memory_order_relaxed),
+            row->check[i].load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && row->seq.load(std::memory_order_relaxed) == seq)
+            return ret;
+    }
+}
+
+inline void core::add_sink(sink_ptr s)
+{
+    auto _ = std::unique_lock(sink_mtx_);
+    auto list = std::make_shared<std::vector<sink_ptr>>(*sinks());
+    list->push_back(s);
+    sinks_.store(std::move(list), std::memory_order_release);
+    sinks_version_.fetch_add(1, std::memory_order_release);
+    sink_count_.fetch_add(1, std::memory_order_relaxed);
+    s->attach(*this);
+}
+
+inline auto core::remove_sink(sink_ptr const& s) -> bool
+{
+    // sink_mtx_ also keeps the worker out, so no delivery to s is in progress;
+    // records queued so far still reach s
+    auto _ = std::unique_lock(sink_mtx_);
+    drain();
+    auto list = std::make_shared<std::vector<sink_ptr>>(*sinks());
+    auto it = std::find(list->begin(), list->end(), s);
+    if (it == list->end())
+        return false;
+    list->erase(it);
+    sinks_.store(std::move(list), std::memory_order_release);
+    sinks_version_.fetch_add(1, std::memory_order_release);
+    sink_count_.fetch_sub(1, std::memory_order_relaxed);
+    details::flush_sink(*s);
+    s->detach(*this);
+    return true;
+}
 
-    core_thread_created = true;
+inline void core::request_flush()
+{
+    flush_requested_.fetch_add(1, std::memory_order_relaxed);
+    worker().wake();
+}
+
+inline auto core::flush(std::chrono::steady_clock::time_point deadline)
+    -> bool
+{
+    auto const ticket =
+        flush_requested_.fetch_add(1, std::memory_order_relaxed) + 1;
+    worker().wake();
 
-    static auto t = details::worker{std::chrono::milliseconds{20}, //
+    auto lock = std::unique_lock(flush_mtx_);
+    return flush_cv_.wait_until(
+        lock, deadline, [ticket] { return flush_completed_ >= ticket; });
+}
+
+inline void core::sync()
+{
+    {
+        auto _ = std::unique_lock(sink_mtx_);
+        for (auto& it : instances) {
+            it->drain();
+            for (auto&& s : *it->sinks())
+                details::flush_sink(*s);
+        }
+        sync_sinks();
+    }
+    wait_synced(std::chrono::steady_clock::time_point::max());
+}
+
+inline void core::sync_sinks()
+{
+    for (auto& it : instances)
+        for (auto&& s : *it->sinks())
+            s->sync();
+}
+
+inline auto core::wait_synced(std::chrono::steady_clock::time_point deadline)
+    -> bool
+{
+    auto lists = std::vector<std::shared_ptr<std::vector<sink_ptr> const>>{};
+    {
+        auto _ = std::unique_lock(sink_mtx_);
+        for (auto& it : instances)
+            lists.push_back(it->sinks());
+    }
+    for (auto const& list : lists)
+        for (auto&& s : *list)
+            if (!s->wait_synced(deadline))
+                return false;
+    return true;
+}
+
+inline void core::request_sync()
+{
+    sync_requested_.fetch_add(1, std::memory_order_relaxed);
+    worker().wake();
+}
+
+inline auto core::sync(std::chrono::steady_clock::time_point deadline) -> bool
+{
+    auto const t0 = std::chrono::steady_clock::now();
+    auto const ticket =
+        sync_requested_.fetch_add(1, std::memory_order_relaxed) + 1;
+    worker().wake();
+
+    auto lock = std::unique_lock(flush_mtx_);
+    auto ret = flush_cv_.wait_until(
+        lock, deadline, [ticket] { return sync_completed_ >= ticket; });
+    lock.unlock();
+    ret = ret && wait_synced(deadline);
+    sync_wait_.record(std::chrono::steady_clock::now() - t0);
+    return ret;
+}
+
+inline void core::background_flush()
+{
+    // the worker is the only writer of the completed counters
+    auto const covered = flush_requested_.load(std::memory_order_relaxed);
+    auto const sync_covered = sync_requested_.load(std::memory_order_relaxed);
+    if (sync_covered != sync_completed_) {
+        auto _ = std::unique_lock(sink_mtx_);
+        for (auto& it : instances) {
+            it->drain();
+            for (auto&& s : *it->sinks())
+                details::flush_sink(*s);
+        }
+        sync_sinks();
+    }
+    else {
+        core::flush();
+    }
+    {
+        auto _ = std::unique_lock(flush_mtx_);
+        flush_completed_ = std::max(flush_completed_, covered);
+        sync_completed_ = std::max(sync_completed_, sync_covered);
+    }
+    flush_cv_.notify_all();
+}
+
+inline auto core::worker() -> details::worker&
+{
+    static auto w = details::worker{std::chrono::milliseconds{20}, //
         []() {
             // execute core activities
-            core::flush();
+            core::background_flush();
         }};
+    return w;
 }
 
 } // namespace zappy
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zappy::details {
+
+// writes as much of sv into fd as possible, waiting up to timeout in total
+// for a non-blocking descriptor to become writable; returns the number of
+// bytes written
+inline auto write_fd(int fd, std::string_view sv,
+    std::chrono::milliseconds timeout) -> std::size_t
+{
+    auto written = std::size_t{0};
+#ifdef _WIN32
+    (void)timeout;
+    while (written < sv.size()) {
+        auto const chunk = unsigned(std::min<std::size_t>(
+            sv.size() - written, std::size_t{1} << 30));
+        auto const n = ::_write(fd, sv.data() + written, chunk);
+        if (n <= 0)
+            break;
+        written += std::size_t(n);
+    }
+#else
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (written < sv.size()) {
+        auto const n = ::write(fd, sv.data() + written, sv.size() - written);
+        if (n > 0) {
+            written += std::size_t(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            auto const left = std::chrono::duration_cast<
+                std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+                break;
+            auto pfd = pollfd{fd, POLLOUT, 0};
+            ::poll(&pfd, 1, int(left.count()));
+            continue;
+        }
+        break;
+    }
+#endif
+    return written;
+}
+
+// fd_channel buffers output for a file descriptor; descriptors that refer to
+// the same file (e.g. stdout and stderr redirected to one place) share a
+// channel, so that records keep their order and are written in one batch
+struct fd_channel {
+    int fd;
+    std::mutex mux;
+    std::string buffer;
+    std::size_t pending_records = 0;
+
+    explicit fd_channel(int d)
+        : fd{d}
+    {
+    }
+
+    static auto get(int fd) -> std::shared_ptr<fd_channel>;
+
+    // writes the buffered data, keeping whatever could not be written in
+    // time; must be called with mux locked
+    void drain(std::chrono::milliseconds timeout)
+    {
+        if (buffer.empty())
+            return;
+        auto const n = write_fd(fd, buffer, timeout);
+        buffer.erase(0, n);
+        if (buffer.empty())
+            pending_records = 0;
+    }
+};
+
+inline auto fd_channel::get(int fd) -> std::shared_ptr<fd_channel>
+{
+    struct entry {
+        unsigned long long dev;
+        unsigned long long ino;
+        std::weak_ptr<fd_channel> channel;
+    };
+    static auto registry_mux = std::mutex{};
+    static auto registry = std::vector<entry>{};
+
+    auto dev = 0ull;
+    auto ino = static_cast<unsigned long long>(fd);
+#ifndef _WIN32
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        dev = static_cast<unsigned long long>(st.st_dev);
+        ino = static_cast<unsigned long long>(st.st_ino);
+    }
+#endif
+
+    auto _ = std::unique_lock(registry_mux);
+    std::erase_if(registry, [](entry const& e) { return e.channel.expired(); });
+    for (auto const& e : registry)
+        if (e.dev == dev && e.ino == ino)
+            if (auto ch = e.channel.lock())
+                return ch;
+
+    auto ch = std::make_shared<fd_channel>(fd);
+    registry.push_back({dev, ino, ch});
+    return ch;
+}
+
+} // namespace zappy::details
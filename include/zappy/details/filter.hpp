@@ -0,0 +1,477 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zappy/details/level.hpp>
+
+namespace zappy {
+namespace details {
+
+// bumped by every change to a filter, lets cores notice that the routes they
+// derived from filters are out of date
+inline std::atomic<std::uint64_t> filter_generation{0};
+
+// outcome of a filter when only part of the record is known
+enum class tri : std::uint8_t { no, yes, maybe };
+
+// filter_program is a filter expression compiled into postfix code, with
+// each string constant stored once in a pool that instructions index; the
+// strings of a record are compared with the constants byte by byte:
+//
+//   expr := term ("||" term)*
+//   term := unary ("&&" unary)*
+//   unary := "!" unary | "(" expr ")" | field op value
+//
+// fields are logger, level, message and attr.<key>; strings compare with
+// == != ^= (prefix) $= (suffix) and *= (contains), levels also with < <= >
+// and >=. Values are bare words or "quoted strings". A missing attribute
+// equals nothing
+struct filter_program {
+    enum class field : std::uint8_t { logger, level, message, attr };
+    enum class opcode : std::uint8_t {
+        eq, ne, prefix, suffix, contains, lt, le, gt, ge, and_, or_, not_
+    };
+
+    struct instr {
+        opcode op;
+        field f = field::logger;
+        zappy::level lv = zappy::level::debug; // operand of level comparisons
+        std::uint32_t key = 0;   // attribute name, index into strings
+        std::uint32_t value = 0; // string operand, index into strings
+    };
+
+    // operands on the evaluation stack at once, deeper expressions are
+    // rejected by compile
+    static constexpr std::size_t max_depth = 32;
+
+    std::vector<std::string> strings;
+    std::vector<instr> code;
+
+    // throws std::invalid_argument naming the offending position
+    static auto compile(std::string_view src) -> filter_program;
+
+    template <typename Record> auto matches(Record const& m) const -> bool
+    {
+        return run([&](instr const& in) {
+            switch (in.f) {
+            case field::logger:
+                return cmp(in, m.logger_name) ? tri::yes : tri::no;
+            case field::level:
+                return cmp(in, m.level) ? tri::yes : tri::no;
+            case field::message:
+                return cmp(in, m.message) ? tri::yes : tri::no;
+            default:
+                break;
+            }
+            auto const key = std::string_view(strings[in.key]);
+            auto found = false;
+            auto hit = false;
+            m.for_each_attr([&](auto const& a) {
+                if (!found && std::string_view(a.key) == key) {
+                    found = true;
+                    hit = cmp(in, std::string_view(a.value));
+                }
+            });
+            if (!found)
+                hit = in.op == opcode::ne;
+            return hit ? tri::yes : tri::no;
+        }) == tri::yes;
+    }
+
+    // evaluates the program knowing only the logger name and the level of a
+    // record, message and attribute comparisons are unknown
+    auto partial(std::string_view logger_name, zappy::level l) const -> tri
+    {
+        return run([&](instr const& in) {
+            switch (in.f) {
+            case field::logger:
+                return cmp(in, logger_name) ? tri::yes : tri::no;
+            case field::level:
+                return cmp(in, l) ? tri::yes : tri::no;
+            default:
+                return tri::maybe;
+            }
+        });
+    }
+
+private:
+    template <typename Leaf> auto run(Leaf&& leaf) const -> tri
+    {
+        auto stack = std::array<tri, max_depth>{};
+        auto top = std::size_t{0};
+        for (auto const& in : code) {
+            switch (in.op) {
+            case opcode::not_:
+                if (stack[top - 1] != tri::maybe)
+                    stack[top - 1] =
+                        stack[top - 1] == tri::yes ? tri::no : tri::yes;
+                break;
+            case opcode::and_: {
+                auto const b = stack[--top];
+                auto& a = stack[top - 1];
+                a = a == tri::no || b == tri::no     ? tri::no
+                    : a == tri::yes && b == tri::yes ? tri::yes
+                                                     : tri::maybe;
+                break;
+            }
+            case opcode::or_: {
+                auto const b = stack[--top];
+                auto& a = stack[top - 1];
+                a = a == tri::yes || b == tri::yes ? tri::yes
+                    : a == tri::no && b == tri::no ? tri::no
+                                                   : tri::maybe;
+                break;
+            }
+            default:
+                stack[top++] = leaf(in);
+            }
+        }
+        return top ? stack[0] : tri::yes;
+    }
+
+    auto cmp(instr const& in, std::string_view v) const -> bool
+    {
+        auto const c = std::string_view(strings[in.value]);
+        switch (in.op) {
+        case opcode::eq:
+            return v == c;
+        case opcode::ne:
+            return v != c;
+        case opcode::prefix:
+            return v.starts_with(c);
+        case opcode::suffix:
+            return v.ends_with(c);
+        case opcode::contains:
+            return v.find(c) != std::string_view::npos;
+        default:
+            return false;
+        }
+    }
+
+    static auto cmp(instr const& in, zappy::level l) -> bool
+    {
+        switch (in.op) {
+        case opcode::eq:
+            return l == in.lv;
+        case opcode::ne:
+            return l != in.lv;
+        case opcode::lt:
+            return l < in.lv;
+        case opcode::le:
+            return l <= in.lv;
+        case opcode::gt:
+            return l > in.lv;
+        default:
+            return l >= in.lv;
+        }
+    }
+};
+
+// recursive descent parser emitting postfix code
+struct filter_parser {
+    using field = filter_program::field;
+    using opcode = filter_program::opcode;
+
+    std::string_view src;
+    std::size_t pos = 0;
+    std::size_t depth = 0; // operands on the stack at the current position
+    std::size_t max_depth = 0;
+    filter_program prog{};
+
+    [[noreturn]] void fail(char const* what) const
+    {
+        throw std::invalid_argument(std::string("zappy: filter: ") + what +
+                                    " at " + std::to_string(pos) + ": " +
+                                    std::string(src));
+    }
+
+    void skip()
+    {
+        while (pos < src.size() && (src[pos] == ' ' || src[pos] == '\t' ||
+                                       src[pos] == '\n' || src[pos] == '\r'))
+            ++pos;
+    }
+
+    auto accept(std::string_view tok) -> bool
+    {
+        skip();
+        if (!src.substr(pos).starts_with(tok))
+            return false;
+        pos += tok.size();
+        return true;
+    }
+
+    static auto is_word(char c) -> bool
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '-' ||
+               c == ':' || c == '/';
+    }
+
+    auto word() -> std::string_view
+    {
+        skip();
+        auto const start = pos;
+        while (pos < src.size() && is_word(src[pos]))
+            ++pos;
+        return src.substr(start, pos - start);
+    }
+
+    auto value() -> std::string
+    {
+        skip();
+        if (pos == src.size() || src[pos] != '"') {
+            auto const w = word();
+            if (w.empty())
+                fail("expected a value");
+            return std::string(w);
+        }
+        auto ret = std::string{};
+        for (++pos; pos < src.size() && src[pos] != '"'; ++pos) {
+            if (src[pos] == '\\' && pos + 1 < src.size())
+                ++pos;
+            ret += src[pos];
+        }
+        if (pos == src.size())
+            fail("unterminated string");
+        ++pos;
+        return ret;
+    }
+
+    auto pool(std::string s) -> std::uint32_t
+    {
+        for (std::size_t i = 0; i < prog.strings.size(); ++i)
+            if (prog.strings[i] == s)
+                return std::uint32_t(i);
+        prog.strings.push_back(std::move(s));
+        return std::uint32_t(prog.strings.size() - 1);
+    }
+
+    void emit(opcode op)
+    {
+        if (op == opcode::and_ || op == opcode::or_)
+            --depth;
+        prog.code.push_back({.op = op});
+    }
+
+    auto parse_op() -> opcode
+    {
+        // two character operators first, "<" is a prefix of "<="
+        static constexpr std::pair<std::string_view, opcode> ops[] = {
+            {"==", opcode::eq}, {"!=", opcode::ne}, {"^=", opcode::prefix},
+            {"$=", opcode::suffix}, {"*=", opcode::contains},
+            {"<=", opcode::le}, {">=", opcode::ge}, {"<", opcode::lt},
+            {">", opcode::gt}};
+        for (auto [tok, op] : ops)
+            if (accept(tok))
+                return op;
+        fail("expected an operator");
+    }
+
+    static auto parse_level(std::string_view s, zappy::level& l) -> bool
+    {
+        static constexpr std::string_view names[] = {
+            "debug", "info", "warn", "error", "critical"};
+        for (std::size_t i = 0; i < std::size(names); ++i) {
+            if (s.size() != names[i].size())
+                continue;
+            auto eq = true;
+            for (std::size_t j = 0; j < s.size() && eq; ++j)
+                eq = (s[j] | 0x20) == names[i][j];
+            if (eq) {
+                l = zappy::level(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void comparison()
+    {
+        auto in = filter_program::instr{.op = opcode::eq};
+        auto const name = word();
+        if (name == "logger")
+            in.f = field::logger;
+        else if (name == "level")
+            in.f = field::level;
+        else if (name == "message" || name == "msg")
+            in.f = field::message;
+        else if (name.starts_with("attr.") && name.size() > 5) {
+            in.f = field::attr;
+            in.key = pool(std::string(name.substr(5)));
+        }
+        else
+            fail(name.empty() ? "expected a field" : "unknown field");
+
+        in.op = parse_op();
+        auto const ordered = in.op >= opcode::lt && in.op <= opcode::ge;
+        auto const on_strings =
+            in.op >= opcode::prefix && in.op <= opcode::contains;
+        if (in.f == field::level) {
+            if (on_strings)
+                fail("string operator on level");
+            if (!parse_level(value(), in.lv))
+                fail("unknown level");
+        }
+        else {
+            if (ordered)
+                fail("ordering operator on a string field");
+            in.value = pool(value());
+        }
+        prog.code.push_back(in);
+        max_depth = std::max(max_depth, ++depth);
+        if (max_depth > filter_program::max_depth)
+            fail("expression too deep");
+    }
+
+    void unary()
+    {
+        if (accept("!")) {
+            unary();
+            emit(opcode::not_);
+        }
+        else if (accept("(")) {
+            expr();
+            if (!accept(")"))
+                fail("expected ')'");
+        }
+        else
+            comparison();
+    }
+
+    void term()
+    {
+        unary();
+        while (accept("&&")) {
+            unary();
+            emit(opcode::and_);
+        }
+    }
+
+    void expr()
+    {
+        term();
+        while (accept("||")) {
+            term();
+            emit(opcode::or_);
+        }
+    }
+
+    auto parse() -> filter_program
+    {
+        skip();
+        if (pos == src.size())
+            return {}; // no code, lets everything through
+        expr();
+        skip();
+        if (pos != src.size())
+            fail("unexpected input");
+        return std::move(prog);
+    }
+};
+
+inline auto filter_program::compile(std::string_view src) -> filter_program
+{
+    return filter_parser{.src = src}.parse();
+}
+
+} // namespace details
+
+// record_filter holds an optional filter expression for a sink or a core;
+// an empty filter lets every record through. It can be replaced while
+// logging is running: readers load the current program without a lock, and
+// set deletes the program it replaced once the readers that may still use
+// it are done
+struct record_filter {
+private:
+    std::atomic<details::filter_program const*> program_{nullptr};
+    // readers count themselves in the slot of the epoch they started in; set
+    // starts a new epoch and waits for the readers of the previous one
+    std::atomic<std::uint64_t> epoch_{0};
+    mutable std::array<std::atomic<std::uint32_t>, 2> readers_{};
+    std::mutex mux_; // serializes set
+
+    // calls f with the current program, which stays alive until f returned
+    template <typename F> auto read(F&& f) const
+    {
+        auto e = epoch_.load();
+        while (true) {
+            readers_[e & 1].fetch_add(1);
+            // a set that started a new epoch meanwhile may not wait for us
+            auto const now = epoch_.load();
+            if (now == e)
+                break;
+            readers_[e & 1].fetch_sub(1, std::memory_order_release);
+            e = now;
+        }
+        auto const ret = f(program_.load());
+        readers_[e & 1].fetch_sub(1, std::memory_order_release);
+        return ret;
+    }
+
+public:
+    record_filter() = default;
+    explicit record_filter(std::string_view expr) { set(expr); }
+    record_filter(record_filter const&) = delete;
+    ~record_filter() { delete program_.load(); }
+
+    auto operator=(std::string_view expr) -> record_filter&
+    {
+        set(expr);
+        return *this;
+    }
+
+    // compiles and installs expr, throws std::invalid_argument if it is not
+    // valid, in which case the current program stays
+    void set(std::string_view expr)
+    {
+        auto p = std::make_unique<details::filter_program const>(
+            details::filter_program::compile(expr));
+        auto _ = std::unique_lock(mux_);
+        auto const old = std::unique_ptr<details::filter_program const>(
+            program_.exchange(p->code.empty() ? nullptr : p.release()));
+        details::filter_generation.fetch_add(1, std::memory_order_release);
+        // readers starting from here on see the new program, old is deleted
+        // once the ones before are done
+        auto const e = epoch_.fetch_add(1);
+        while (readers_[e & 1].load(std::memory_order_acquire))
+            std::this_thread::yield();
+    }
+
+    void clear() { set({}); }
+
+    auto empty() const -> bool
+    {
+        return !program_.load(std::memory_order_acquire);
+    }
+
+    template <typename Record> auto matches(Record const& m) const -> bool
+    {
+        if (empty())
+            return true;
+        return read([&](details::filter_program const* p) {
+            return !p || p->matches(m);
+        });
+    }
+
+    auto partial(std::string_view logger_name, level l) const -> details::tri
+    {
+        if (empty())
+            return details::tri::yes;
+        return read([&](details::filter_program const* p) {
+            return p ? p->partial(logger_name, l) : details::tri::yes;
+        });
+    }
+};
+
+} // namespace zappy
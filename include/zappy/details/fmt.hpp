@@ -40,6 +40,8 @@ inline void to_json(std::string& out, msg const& m)
         details::json_scramble(w, attr.value);
         w("\"");
     }
+    if (m.context)
+        w(m.context->json);
 
     w("}");
 }
@@ -77,6 +79,8 @@ inline void to_text(std::string& out, msg const& m)
         w("=");
         details::json_scramble(w, attr.value);
     }
+    if (m.context)
+        w(m.context->text);
 }
 
 struct ansi_fmt {
@@ -105,11 +109,15 @@ struct ansi_fmt {
         std::string after;
     } attr;
 
+    // context attributes are pre-rendered with the default attr sections
+    bool use_ansi_sequences;
+
     ansi_fmt(bool use_ansi_sequences);
     void format(std::string&, msg const&);
 };
 
 inline ansi_fmt::ansi_fmt(bool use_ansi_sequences)
+    : use_ansi_sequences{use_ansi_sequences}
 {
     auto s = [use_ansi_sequences](std::string_view v) -> std::string {
         return use_ansi_sequences ? std::string(v) : "";
@@ -131,6 +139,7 @@ inline ansi_fmt::ansi_fmt(bool use_ansi_sequences)
     attr = {
         .before = s(ansi::dark) + std::string(" | "),
         .between = std::string("=") + s(ansi::reset),
+        .after = {},
     };
 }
 
@@ -184,6 +193,44 @@ inline void ansi_fmt::format(std::string& out, msg const& m)
         details::json_scramble(w, attribute.value);
         w(attr.after);
     }
+    if (m.context)
+        w(use_ansi_sequences ? m.context->ansi : m.context->text);
 }
 
+namespace details {
+
+// renders the fragments of a context from its attributes
+inline void render_context(attr_context& ctx)
+{
+    auto const fmt = ansi_fmt(true);
+    ctx.json.clear();
+    ctx.text.clear();
+    ctx.ansi.clear();
+    for (auto a : ctx.attributes) {
+        auto j = [&](std::string_view sv) { ctx.json += sv; };
+        j(",\"");
+        json_scramble(j, a.key);
+        j("\":\"");
+        json_scramble(j, a.value);
+        j("\"");
+
+        auto t = [&](std::string_view sv) { ctx.text += sv; };
+        auto const start = ctx.text.size();
+        t(" | ");
+        json_scramble(t, a.key);
+        t("=");
+        auto const value_start = ctx.text.size();
+        json_scramble(t, a.value);
+
+        // same escaped key and value, with colors around them
+        ctx.ansi += fmt.attr.before;
+        ctx.ansi.append(ctx.text, start + 3, value_start - 1 - start - 3);
+        ctx.ansi += fmt.attr.between;
+        ctx.ansi.append(ctx.text, value_start);
+        ctx.ansi += fmt.attr.after;
+    }
+}
+
+} // namespace details
+
 } // namespace zappy
\ No newline at end of file
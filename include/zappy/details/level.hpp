@@ -0,0 +1,13 @@
+#pragma once
+
+namespace zappy {
+
+enum class level {
+    debug, // lowest priority messages for detailed app debugging
+    info,// info is the default logging priority
+    warn,// warning messages are more important than info
+    error,// high priority messages. i.e., If a system is running smoothly, it should not generate any error-level messages
+    critical,// highest priority, critical errors that require special attention
+};
+
+} // namespace zappy
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <bit>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define ZAPPY_HAS_SSE2 1
+#endif
+
+namespace zappy::details {
+
+// returns a pointer to the first occurrence of c in [first, last), or last
+inline auto find_char(char const* first, char const* last, char c)
+    -> char const*
+{
+#ifdef __AVX2__
+    auto const needle32 = _mm256_set1_epi8(c);
+    for (; last - first >= 32; first += 32) {
+        auto const chunk =
+            _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+        if (auto mask = unsigned(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32))))
+            return first + std::countr_zero(mask);
+    }
+#endif
+#ifdef ZAPPY_HAS_SSE2
+    auto const needle16 = _mm_set1_epi8(c);
+    for (; last - first >= 16; first += 16) {
+        auto const chunk =
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+        if (auto mask =
+                unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16))))
+            return first + std::countr_zero(mask);
+    }
+#endif
+    if (first == last)
+        return last;
+    auto p = std::memchr(first, c, std::size_t(last - first));
+    return p ? static_cast<char const*>(p) : last;
+}
+
+// invokes callback(std::string_view line) for every non-empty line in text,
+// line terminators ('\n' and a trailing '\r') are not included
+template <typename Callback>
+void for_each_line(std::string_view text, Callback&& callback)
+{
+    auto cursor = text.data();
+    auto const end = text.data() + text.size();
+    while (cursor != end) {
+        auto eol = find_char(cursor, end, '\n');
+        auto line_end = eol;
+        if (line_end != cursor && line_end[-1] == '\r')
+            --line_end;
+        if (line_end != cursor)
+            callback(std::string_view(cursor, std::size_t(line_end - cursor)));
+        cursor = eol == end ? end : eol + 1;
+    }
+}
+
+// finds the closing quote of a json string whose content starts at first,
+// skipping backslash escapes; returns last if the string is unterminated
+inline auto find_string_end(char const* first, char const* last)
+    -> char const*
+{
+    while (first != last) {
+        auto q = find_char(first, last, '"');
+        if (q == last)
+            return last;
+        auto bs = q;
+        while (bs != first && bs[-1] == '\\')
+            --bs;
+        if (((q - bs) & 1) == 0)
+            return q;
+        first = q + 1;
+    }
+    return last;
+}
+
+} // namespace zappy::details
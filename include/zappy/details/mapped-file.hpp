@@ -0,0 +1,109 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zappy::details {
+
+// read-only view of a whole file, memory-mapped where the platform allows it
+// (falls back to reading the file into memory otherwise)
+struct mapped_file {
+private:
+    char const* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool open_ = false;
+    std::string fallback_;
+
+    void unmap();
+
+public:
+    mapped_file() = default;
+    explicit mapped_file(std::filesystem::path const& fn);
+    mapped_file(mapped_file const&) = delete;
+    mapped_file(mapped_file&& other) noexcept;
+    ~mapped_file() { unmap(); }
+
+    auto operator=(mapped_file const&) -> mapped_file& = delete;
+    auto operator=(mapped_file&& other) noexcept -> mapped_file&;
+
+    auto is_open() const -> bool { return open_; }
+    auto view() const -> std::string_view { return {data_, size_}; }
+    auto size() const -> std::size_t { return size_; }
+};
+
+inline mapped_file::mapped_file(std::filesystem::path const& fn)
+{
+#ifndef _WIN32
+    auto fd = ::open(fn.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    open_ = ::fstat(fd, &st) == 0;
+    if (open_ && st.st_size > 0) {
+        auto p = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ,
+            MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<char const*>(p);
+            size_ = std::size_t(st.st_size);
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(fd);
+    if (data_ || (open_ && st.st_size == 0))
+        return;
+#endif
+    auto strm = std::ifstream{fn, std::ios::in | std::ios::binary};
+    if (!strm.is_open())
+        return;
+    fallback_.assign(std::istreambuf_iterator<char>(strm),
+        std::istreambuf_iterator<char>());
+    data_ = fallback_.data();
+    size_ = fallback_.size();
+    open_ = true;
+}
+
+inline mapped_file::mapped_file(mapped_file&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+inline auto mapped_file::operator=(mapped_file&& other) noexcept
+    -> mapped_file&
+{
+    if (this != &other) {
+        unmap();
+        auto const own = other.data_ == other.fallback_.data();
+        fallback_ = std::move(other.fallback_);
+        data_ = own ? fallback_.data() : other.data_;
+        size_ = other.size_;
+        open_ = other.open_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.open_ = false;
+    }
+    return *this;
+}
+
+inline void mapped_file::unmap()
+{
+#ifndef _WIN32
+    if (data_ && data_ != fallback_.data())
+        ::munmap(const_cast<char*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    open_ = false;
+    fallback_.clear();
+}
+
+} // namespace zappy::details
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+namespace zappy {
+
+// a point-in-time copy of the counters of a memory resource; reserved minus
+// in_use is held by the resource without being handed out, i.e. its slack
+// and fragmentation
+struct memory_stats {
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    std::size_t in_use = 0;   // bytes handed out and not returned yet
+    std::size_t peak = 0;     // highest in_use
+    std::size_t reserved = 0; // bytes taken from the upstream resource
+};
+
+namespace details {
+
+struct memory_counters {
+    std::atomic<std::uint64_t> allocations{0};
+    std::atomic<std::uint64_t> deallocations{0};
+    std::atomic<std::size_t> in_use{0};
+    std::atomic<std::size_t> peak{0};
+    std::atomic<std::size_t> reserved{0};
+
+    void allocated(std::size_t n) noexcept
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        auto const u = in_use.fetch_add(n, std::memory_order_relaxed) + n;
+        auto p = peak.load(std::memory_order_relaxed);
+        while (u > p &&
+               !peak.compare_exchange_weak(p, u, std::memory_order_relaxed)) {
+        }
+    }
+
+    void deallocated(std::size_t n) noexcept
+    {
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+        in_use.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    auto snapshot() const noexcept -> memory_stats
+    {
+        return {allocations.load(std::memory_order_relaxed),
+            deallocations.load(std::memory_order_relaxed),
+            in_use.load(std::memory_order_relaxed),
+            peak.load(std::memory_order_relaxed),
+            reserved.load(std::memory_order_relaxed)};
+    }
+};
+
+} // namespace details
+
+// counting_resource forwards to an upstream resource, counting what goes
+// through it
+struct counting_resource : std::pmr::memory_resource {
+private:
+    std::pmr::memory_resource* upstream_;
+    details::memory_counters counters_;
+
+    auto do_allocate(std::size_t bytes, std::size_t align) -> void* override
+    {
+        auto p = upstream_->allocate(bytes, align);
+        counters_.allocated(bytes);
+        counters_.reserved.fetch_add(bytes, std::memory_order_relaxed);
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override
+    {
+        upstream_->deallocate(p, bytes, align);
+        counters_.deallocated(bytes);
+        counters_.reserved.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    auto do_is_equal(memory_resource const& other) const noexcept
+        -> bool override
+    {
+        return this == &other;
+    }
+
+public:
+    explicit counting_resource(
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream_{upstream}
+    {
+    }
+
+    auto stats() const -> memory_stats { return counters_.snapshot(); }
+};
+
+// arena_resource is a monotonic resource for log records: small blocks are
+// carved from large chunks with a single atomic add, without taking a lock,
+// and chunks go back upstream only when the arena is destroyed. Large or
+// over-aligned blocks are forwarded to the upstream resource.
+//
+// queue slots keep their capacity from record to record, so the arena stops
+// growing once the slots have reached the usual record size
+struct arena_resource : std::pmr::memory_resource {
+private:
+    static constexpr std::size_t granule = alignof(std::max_align_t);
+    static constexpr std::size_t header_size = 64;
+
+    struct chunk {
+        chunk* next;
+        std::size_t size;
+        std::atomic<std::size_t> used{0};
+
+        auto data() -> char*
+        {
+            return reinterpret_cast<char*>(this) + header_size;
+        }
+    };
+    static_assert(sizeof(chunk) <= header_size);
+
+    struct large_block {
+        void* p;
+        std::size_t bytes;
+        std::size_t align;
+    };
+
+    std::pmr::memory_resource* upstream_;
+    std::size_t chunk_size_;
+    std::atomic<chunk*> current_{nullptr};
+    std::mutex mux_; // guards chunks_ and large_
+    chunk* chunks_ = nullptr;
+    std::vector<large_block> large_;
+    details::memory_counters counters_;
+
+    auto is_large(std::size_t bytes, std::size_t align) const -> bool
+    {
+        return align > granule || bytes > chunk_size_ / 4;
+    }
+
+    static auto round_up(std::size_t n) -> std::size_t
+    {
+        return (std::max<std::size_t>(n, 1) + granule - 1) / granule * granule;
+    }
+
+    void add_chunk()
+    {
+        auto const total = header_size + chunk_size_;
+        auto c = new (upstream_->allocate(total, header_size)) chunk{};
+        c->next = chunks_;
+        c->size = chunk_size_;
+        chunks_ = c;
+        counters_.reserved.fetch_add(total, std::memory_order_relaxed);
+        current_.store(c, std::memory_order_release);
+    }
+
+    auto do_allocate(std::size_t bytes, std::size_t align) -> void* override
+    {
+        if (is_large(bytes, align)) {
+            auto _ = std::unique_lock(mux_);
+            auto p = upstream_->allocate(bytes, align);
+            large_.push_back({p, bytes, align});
+            counters_.allocated(bytes);
+            counters_.reserved.fetch_add(bytes, std::memory_order_relaxed);
+            return p;
+        }
+
+        auto const n = round_up(bytes);
+        while (true) {
+            auto c = current_.load(std::memory_order_acquire);
+            if (c) {
+                auto const off = c->used.fetch_add(n, std::memory_order_relaxed);
+                if (off + n <= c->size) {
+                    counters_.allocated(n);
+                    return c->data() + off;
+                }
+            }
+            // the chunk is exhausted, the first thread to notice adds one
+            auto _ = std::unique_lock(mux_);
+            if (current_.load(std::memory_order_relaxed) == c)
+                add_chunk();
+        }
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override
+    {
+        if (!is_large(bytes, align)) {
+            counters_.deallocated(round_up(bytes));
+            return;
+        }
+        auto _ = std::unique_lock(mux_);
+        auto it = std::find_if(large_.begin(), large_.end(),
+            [p](large_block const& b) { return b.p == p; });
+        if (it == large_.end())
+            return;
+        upstream_->deallocate(p, bytes, align);
+        large_.erase(it);
+        counters_.deallocated(bytes);
+        counters_.reserved.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    auto do_is_equal(memory_resource const& other) const noexcept
+        -> bool override
+    {
+        return this == &other;
+    }
+
+public:
+    explicit arena_resource(std::size_t chunk_size = 1 << 20,
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream_{upstream}
+        , chunk_size_{round_up(chunk_size)}
+    {
+    }
+
+    arena_resource(arena_resource const&) = delete;
+
+    ~arena_resource()
+    {
+        for (auto const& b : large_)
+            upstream_->deallocate(b.p, b.bytes, b.align);
+        while (chunks_) {
+            auto next = chunks_->next;
+            chunks_->~chunk();
+            upstream_->deallocate(chunks_, header_size + chunk_size_, header_size);
+            chunks_ = next;
+        }
+    }
+
+    auto stats() const -> memory_stats { return counters_.snapshot(); }
+};
+
+} // namespace zappy
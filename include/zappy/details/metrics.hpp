@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace zappy {
+
+// histogram of durations with power-of-two nanosecond buckets: bucket 0 counts
+// durations below 1ns, bucket i counts durations in [2^(i-1), 2^i) ns
+struct latency_histogram {
+    static constexpr std::size_t bucket_count = 48;
+
+    std::array<std::uint64_t, bucket_count> buckets{};
+    std::chrono::nanoseconds max{0};
+
+    auto count() const -> std::uint64_t
+    {
+        auto n = std::uint64_t{0};
+        for (auto b : buckets)
+            n += b;
+        return n;
+    }
+
+    // upper bound of the bucket containing the q-th quantile, q in [0, 1]
+    auto percentile(double q) const -> std::chrono::nanoseconds
+    {
+        auto const n = count();
+        if (!n)
+            return {};
+        auto const rank = std::uint64_t(q * double(n - 1)) + 1;
+        auto seen = std::uint64_t{0};
+        for (std::size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(max, std::chrono::nanoseconds(
+                                         std::int64_t{1} << i));
+        }
+        return max;
+    }
+};
+
+// a point-in-time copy of the counters of a single sink
+struct sink_metrics {
+    std::uint64_t records = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t dropped = 0; // accepted by the sink but never written
+    std::uint64_t rotations = 0;
+    std::uint64_t syncs = 0; // fdatasync calls
+    latency_histogram write_latency;
+    latency_histogram flush_latency;
+    latency_histogram sync_latency;
+};
+
+// a point-in-time copy of the counters of a core and its sinks
+struct core_metrics {
+    std::uint64_t enqueued = 0;
+    std::uint64_t dropped = 0; // discarded by the pipeline instead of queued
+    // summed over the priority lanes of the core
+    std::size_t queue_size = 0;
+    std::size_t queue_capacity = 0;
+    // the most records a single lane held at once; the lanes peak at
+    // different times, so their peaks do not add up
+    std::size_t queue_high_water = 0;
+    std::uint64_t blocked_pushes = 0;
+    std::chrono::nanoseconds blocked_time{0};
+    // time callers of core::sync waited for their records to be durable,
+    // shared by all cores
+    latency_histogram sync_wait{};
+    std::vector<sink_metrics> sinks{};
+};
+
+namespace details {
+
+// counters are updated with relaxed atomics, they are cheap enough to be
+// always on and are only ever read for reporting
+struct counter {
+    std::atomic<std::uint64_t> v{0};
+
+    void add(std::uint64_t n = 1) noexcept
+    {
+        v.fetch_add(n, std::memory_order_relaxed);
+    }
+    auto load() const noexcept -> std::uint64_t
+    {
+        return v.load(std::memory_order_relaxed);
+    }
+};
+
+struct latency_recorder {
+    std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count>
+        buckets{};
+    std::atomic<std::int64_t> max_ns{0};
+
+    void record(std::chrono::nanoseconds d) noexcept
+    {
+        auto const ns = std::max<std::int64_t>(d.count(), 0);
+        auto const i = std::min<std::size_t>(
+            std::bit_width(std::uint64_t(ns)), buckets.size() - 1);
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+        auto prev = max_ns.load(std::memory_order_relaxed);
+        while (prev < ns && !max_ns.compare_exchange_weak(
+                                prev, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    auto snapshot() const -> latency_histogram
+    {
+        auto ret = latency_histogram{};
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+            ret.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        ret.max = std::chrono::nanoseconds(
+            max_ns.load(std::memory_order_relaxed));
+        return ret;
+    }
+};
+
+struct sink_counters {
+    counter records;
+    counter bytes;
+    counter dropped;
+    counter rotations;
+    counter syncs;
+    latency_recorder write_latency;
+    latency_recorder flush_latency;
+    latency_recorder sync_latency;
+
+    auto snapshot() const -> sink_metrics
+    {
+        return {
+            .records = records.load(),
+            .bytes = bytes.load(),
+            .dropped = dropped.load(),
+            .rotations = rotations.load(),
+            .syncs = syncs.load(),
+            .write_latency = write_latency.snapshot(),
+            .flush_latency = flush_latency.snapshot(),
+            .sync_latency = sync_latency.snapshot(),
+        };
+    }
+};
+
+// measures the wall time of a scope into a latency_recorder
+struct latency_scope {
+    latency_recorder& r;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    ~latency_scope() { r.record(std::chrono::steady_clock::now() - t0); }
+};
+
+} // namespace details
+
+} // namespace zappy
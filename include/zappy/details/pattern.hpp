@@ -0,0 +1,331 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zappy/details/ansi.hpp>
+#include <zappy/details/common.hpp>
+#include <zappy/details/json-scrambler.hpp>
+#include <zappy/details/stringers.hpp>
+
+namespace zappy {
+
+// pattern_fmt formats records after a pattern compiled once, e.g.
+//
+//   "{ts:us} {level:5}{logger: (l)} {msg}{attrs: k=v}"
+//
+// placeholders:
+//   {ts}, {ts:s|ms|us|ns}  UTC timestamp, to the given fraction (ms)
+//   {level}, {level:N}     level name, padded to N; {LEVEL} in upper case
+//   {logger}, {logger:SPEC}
+//                          logger name, or SPEC with l replaced by it;
+//                          records without a logger write neither
+//   {msg}                  message, escaped like to_text
+//   {attrs}, {attrs:SPEC}  attributes, each written as SPEC with k and v
+//                          replaced by key and value (" | k=v")
+// and {{ }} for literal braces. The pattern becomes a flat list of ops, each
+// writing the constant text before it, styles included, in one run; levels
+// are rendered into a table per placeholder up front, and the specs of the
+// other placeholders are kept per placeholder as well
+struct pattern_fmt {
+    static constexpr std::string_view default_pattern =
+        "{ts}{logger: [l]} [{level:5}] {msg}{attrs}";
+
+    explicit pattern_fmt(std::string_view pattern = default_pattern,
+        bool use_ansi_sequences = false);
+
+    void format(std::string& out, msg const& m) const;
+
+private:
+    enum class kind : std::uint8_t { text, ts, level, logger, message, attrs };
+
+    struct op {
+        kind k;
+        std::uint8_t digits = 0; // of the timestamp fraction
+        std::uint16_t table = 0; // index in levels_ or affixes_
+        std::uint32_t offset = 0; // of the constant text before, in text_
+        std::uint32_t size = 0;
+    };
+
+    bool use_ansi_;
+    std::string text_; // constant text of all ops
+    std::uint32_t pending_ = 0; // start of the text no op writes yet
+    std::vector<op> ops_;
+    // styled and padded, by level, one table per level placeholder
+    std::vector<std::array<std::string, 5>> levels_;
+    // the spec of a logger or attrs placeholder: before the name or key,
+    // between key and value, after the name or value
+    struct affix {
+        std::string before;
+        std::string between;
+        std::string after;
+        // context attributes rendered with the default spec can be spliced
+        bool spliced = false;
+    };
+    std::vector<affix> affixes_;
+
+    void literal(std::string_view sv);
+    void push(op o);
+    void placeholder(std::string_view name, std::string_view spec,
+        std::string_view pattern);
+    auto style(std::string_view s) const -> std::string_view
+    {
+        return use_ansi_ ? s : std::string_view{};
+    }
+};
+
+inline pattern_fmt::pattern_fmt(
+    std::string_view pattern, bool use_ansi_sequences)
+    : use_ansi_{use_ansi_sequences}
+{
+    auto fail = [&](char const* what) {
+        throw std::invalid_argument(std::string("zappy: pattern: ") + what +
+                                    ": " + std::string(pattern));
+    };
+
+    auto i = std::size_t{0};
+    while (i < pattern.size()) {
+        auto const c = pattern[i];
+        if ((c == '{' || c == '}') && i + 1 < pattern.size() &&
+            pattern[i + 1] == c) {
+            literal(pattern.substr(i, 1));
+            i += 2;
+            continue;
+        }
+        if (c == '}')
+            fail("unmatched '}'");
+        if (c != '{') {
+            auto const end = pattern.find_first_of("{}", i);
+            auto const n = end == std::string_view::npos ? pattern.size() - i
+                                                         : end - i;
+            literal(pattern.substr(i, n));
+            i += n;
+            continue;
+        }
+        auto const close = pattern.find('}', i);
+        if (close == std::string_view::npos)
+            fail("unterminated placeholder");
+        auto const body = pattern.substr(i + 1, close - i - 1);
+        auto const colon = body.find(':');
+        placeholder(body.substr(0, colon),
+            colon == std::string_view::npos ? std::string_view{}
+                                            : body.substr(colon + 1),
+            pattern);
+        i = close + 1;
+    }
+    if (text_.size() > pending_)
+        push({.k = kind::text});
+}
+
+inline void pattern_fmt::literal(std::string_view sv)
+{
+    if (sv.empty())
+        return;
+    if (!ops_.empty() && ops_.back().k == kind::level &&
+        text_.size() == pending_) {
+        // text right after a level becomes part of its table
+        for (auto& l : levels_.back())
+            l += sv;
+        return;
+    }
+    text_ += sv;
+}
+
+inline void pattern_fmt::push(op o)
+{
+    o.offset = pending_;
+    o.size = std::uint32_t(text_.size()) - pending_;
+    pending_ = std::uint32_t(text_.size());
+    ops_.push_back(o);
+}
+
+inline void pattern_fmt::placeholder(
+    std::string_view name, std::string_view spec, std::string_view pattern)
+{
+    auto fail = [&](char const* what) {
+        throw std::invalid_argument(std::string("zappy: pattern: ") + what +
+                                    " '" + std::string(name) +
+                                    "': " + std::string(pattern));
+    };
+
+    if (name == "ts") {
+        auto digits = std::uint8_t{3};
+        if (spec == "s")
+            digits = 0;
+        else if (spec == "us")
+            digits = 6;
+        else if (spec == "ns")
+            digits = 9;
+        else if (!spec.empty() && spec != "ms")
+            fail("invalid precision for");
+        literal(style(ansi::dark));
+        push({.k = kind::ts, .digits = digits});
+        literal(style(ansi::reset));
+    }
+    else if (name == "level" || name == "LEVEL") {
+        auto width = std::size_t{0};
+        for (auto c : spec) {
+            if (c < '0' || c > '9' || width > 64)
+                fail("invalid width for");
+            width = width * 10 + std::size_t(c - '0');
+        }
+        // and so does the text before it
+        auto const prefix = text_.substr(pending_);
+        text_.resize(pending_);
+        static constexpr std::string_view styles[] = {
+            ansi::blue, ansi::green, ansi::yellow, ansi::red, ansi::red};
+        auto& table = levels_.emplace_back();
+        for (std::size_t l = 0; l < table.size(); ++l) {
+            auto& s = table[l];
+            auto const text = to_sv(level(l), name == "LEVEL");
+            s = prefix;
+            s += style(styles[l]);
+            if (level(l) == level::critical)
+                s += style(ansi::bold);
+            s += text;
+            s += style(ansi::reset);
+            if (text.size() < width)
+                s.append(width - text.size(), ' ');
+        }
+        push({.k = kind::level,
+            .table = std::uint16_t(levels_.size() - 1)});
+    }
+    else if (name == "logger") {
+        auto& a = affixes_.emplace_back();
+        if (!spec.empty()) {
+            auto const l = spec.find('l');
+            if (l == std::string_view::npos)
+                fail("expected l in the spec of");
+            a.before = spec.substr(0, l);
+            a.after = spec.substr(l + 1);
+        }
+        push({.k = kind::logger,
+            .table = std::uint16_t(affixes_.size() - 1)});
+    }
+    else if (name == "msg" || name == "message") {
+        push({.k = kind::message});
+    }
+    else if (name == "attrs") {
+        if (spec.empty())
+            spec = " | k=v";
+        auto const k = spec.find('k');
+        auto const v = spec.find('v', k == std::string_view::npos ? 0 : k + 1);
+        if (k == std::string_view::npos || v == std::string_view::npos)
+            fail("expected k and v in the spec of");
+        auto& a = affixes_.emplace_back();
+        a.spliced = spec == " | k=v";
+        a.before = style(ansi::dark);
+        a.before += spec.substr(0, k);
+        a.between = spec.substr(k + 1, v - k - 1);
+        a.between += style(ansi::reset);
+        a.after = spec.substr(v + 1);
+        push({.k = kind::attrs,
+            .table = std::uint16_t(affixes_.size() - 1)});
+    }
+    else {
+        fail("unknown placeholder");
+    }
+}
+
+inline void pattern_fmt::format(std::string& out, msg const& m) const
+{
+    out.clear();
+    auto w = [&](std::string_view sv) { out += sv; };
+    // text without characters to escape, most of it, is appended in one go
+    auto escaped = [&](std::string_view sv) {
+        auto i = std::size_t{0};
+        while (i < sv.size() && static_cast<unsigned char>(sv[i]) >= 0x20 &&
+               sv[i] != '"' && sv[i] != '\\')
+            ++i;
+        out += sv.substr(0, i);
+        if (i < sv.size())
+            details::json_scramble(w, sv.substr(i));
+    };
+    auto attrs = [&](affix const& spec, details::attr_list const& list) {
+        auto const before = std::string_view(spec.before);
+        auto const between = std::string_view(spec.between);
+        auto const after = std::string_view(spec.after);
+        for (auto const& a : list) {
+            out += before;
+            escaped(a.key);
+            out += between;
+            escaped(a.value);
+            if (!after.empty())
+                out += after;
+        }
+    };
+
+    for (auto const& o : ops_) {
+        if (o.size)
+            out.append(text_.data() + o.offset, o.size);
+        switch (o.k) {
+        case kind::text:
+            break;
+        case kind::ts: {
+            // date and time of day change once a second, they are rendered
+            // by to_chars only when the second changes
+            struct cache {
+                std::int64_t second = -1;
+                char text[27];
+            };
+            thread_local auto last = cache{};
+            using std::chrono::nanoseconds;
+            auto const ns = std::chrono::duration_cast<nanoseconds>(
+                m.timestamp.time_since_epoch())
+                                .count();
+            auto const second = ns / 1000000000;
+            if (second != last.second) {
+                to_chars(last.text, last.text + 27, m.timestamp);
+                last.second = second;
+            }
+            char buf[11];
+            auto p = buf;
+            if (o.digits) {
+                auto f = std::uint64_t(ns - second * 1000000000);
+                for (auto d = o.digits; d < 9; ++d)
+                    f /= 10;
+                *p = '.';
+                for (auto d = o.digits; d; --d, f /= 10)
+                    p[d] = char('0' + f % 10);
+                p += o.digits + 1;
+            }
+            *p++ = 'Z';
+            out.append(last.text, 19);
+            out.append(buf, std::size_t(p - buf));
+            break;
+        }
+        case kind::level:
+            w(levels_[o.table][std::size_t(m.level)]);
+            break;
+        case kind::logger: {
+            if (m.logger_name.empty())
+                break;
+            auto const& a = affixes_[o.table];
+            w(a.before);
+            w(m.logger_name);
+            w(a.after);
+            break;
+        }
+        case kind::message:
+            escaped(m.message);
+            break;
+        case kind::attrs: {
+            auto const& a = affixes_[o.table];
+            attrs(a, m.attributes);
+            if (!m.context)
+                break;
+            if (a.spliced)
+                w(use_ansi_ ? m.context->ansi : m.context->text);
+            else
+                attrs(a, m.context->attributes);
+            break;
+        }
+        }
+    }
+}
+
+} // namespace zappy
@@ -1,24 +1,60 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <memory_resource>
 #include <mutex>
-#include <zappy/details/circular.hpp>
+#include <utility>
 #include <vector>
+#include <zappy/details/circular.hpp>
 
 namespace zappy::details {
 
+struct queue_stats {
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+    std::size_t high_water = 0;
+    std::uint64_t blocked_pushes = 0;
+    std::chrono::nanoseconds blocked_time{0};
+};
+
 template <typename T> struct queue {
 private:
     mutable std::mutex mux_;
-    std::vector<T> buffer_;
+    std::pmr::vector<T> buffer_;
     circular<T> circular_;
     std::condition_variable not_empty;
     std::condition_variable not_full;
 
+    std::size_t high_water_ = 0;
+    std::uint64_t blocked_pushes_ = 0;
+    std::chrono::nanoseconds blocked_time_{0};
+
+    // waits for a free slot, accounting for the time spent blocked
+    void wait_not_full(std::unique_lock<std::mutex>& lock)
+    {
+        if (!circular_.full())
+            return;
+        auto const t0 = std::chrono::steady_clock::now();
+        not_full.wait(lock, [this] { return !this->circular_.full(); });
+        ++blocked_pushes_;
+        blocked_time_ += std::chrono::steady_clock::now() - t0;
+    }
+
+    void pushed()
+    {
+        high_water_ = std::max(high_water_, circular_.size());
+        not_empty.notify_one();
+    }
+
 public:
-    queue(std::size_t capacity)
-        : buffer_(capacity)
+    // the slots are allocated from mr, allocator-aware items are constructed
+    // with it as well
+    queue(std::size_t capacity,
+        std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : buffer_(capacity, mr)
         , circular_{buffer_}
     {
     }
@@ -26,26 +62,64 @@ public:
     void push(T&& v)
     {
         auto lock = std::unique_lock(mux_);
-        not_full.wait(lock, [this] { return !this->circular_.full(); });
+        wait_not_full(lock);
         circular_.push_back(std::move(v));
-        not_empty.notify_one();
+        pushed();
     }
 
     void push(T const& v)
     {
         auto lock = std::unique_lock(mux_);
-        not_full.wait(lock, [this] { return !this->circular_.full(); });
+        wait_not_full(lock);
         circular_.push_back(v);
-        not_empty.notify_one();
+        pushed();
+    }
+
+    // fills the next free slot in place by calling fill(T&); the slot still
+    // holds an item handed back by a consumer, whose capacity fill can reuse
+    template <typename Fill> void push_in_place(Fill&& fill)
+    {
+        auto lock = std::unique_lock(mux_);
+        wait_not_full(lock);
+        fill(circular_.next());
+        circular_.commit_back();
+        pushed();
+    }
+
+    // pushes without waiting, returns false if the queue is full
+    auto try_push(T&& v) -> bool
+    {
+        auto lock = std::unique_lock(mux_);
+        if (circular_.full())
+            return false;
+        circular_.push_back(std::move(v));
+        pushed();
+        return true;
     }
 
+    // pushes without waiting, discarding the oldest item if the queue is
+    // full; returns false if an item was discarded
+    auto push_overwrite(T&& v) -> bool
+    {
+        auto lock = std::unique_lock(mux_);
+        auto const was_full = circular_.full();
+        if (was_full)
+            circular_.pop_front();
+        circular_.push_back(std::move(v));
+        pushed();
+        return !was_full;
+    }
+
+    // pops by swapping, v's previous content goes back into the slot so
+    // that its capacity is reused by a later push_in_place
     auto try_pop(T& v) -> bool
     {
         {
             auto lock = std::unique_lock(mux_);
             if (circular_.empty())
                 return false;
-            v = std::move(circular_.front());
+            using std::swap;
+            swap(v, circular_.front());
             circular_.pop_front();
         }
         not_full.notify_one();
@@ -57,10 +131,11 @@ public:
         auto lock = std::unique_lock(mux_);
         {
             if (!not_empty.wait_for(lock, wait_duration,
-                    [this] { return !this->circular.empty(); }))
+                    [this] { return !this->circular_.empty(); }))
                 return false;
 
-            v = std::move(circular_.front());
+            using std::swap;
+            swap(v, circular_.front());
             circular_.pop_front();
         }
         not_full.notify_one();
@@ -82,6 +157,12 @@ public:
         auto lock = std::unique_lock(mux_);
         return circular_.full();
     }
+    auto stats() const -> queue_stats
+    {
+        auto lock = std::unique_lock(mux_);
+        return {circular_.size(), buffer_.size(), high_water_,
+            blocked_pushes_, blocked_time_};
+    }
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <zappy/details/common.hpp>
+
+namespace zappy::details {
+
+// compact binary encoding of a record, in host byte order:
+//
+//   i64 timestamp (ns since epoch), u8 level,
+//   u32 + bytes logger name, u32 + bytes message,
+//   u32 attribute count, then u32 + bytes for every key and value
+//
+// used for handing records over without formatting them
+template <typename ForEachAttr>
+inline void encode_record(std::string& out, clock::time_point timestamp,
+    level l, std::string_view logger_name, std::string_view message,
+    std::size_t attr_count, ForEachAttr&& for_each_attr)
+{
+    auto put_u32 = [&](std::uint32_t v) {
+        char buf[sizeof(v)];
+        std::memcpy(buf, &v, sizeof(v));
+        out.append(buf, sizeof(v));
+    };
+    auto put_str = [&](std::string_view sv) {
+        put_u32(std::uint32_t(sv.size()));
+        out.append(sv);
+    };
+
+    auto const ts = std::int64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            timestamp.time_since_epoch())
+            .count());
+    char buf[sizeof(ts)];
+    std::memcpy(buf, &ts, sizeof(ts));
+    out.append(buf, sizeof(ts));
+    out += char(l);
+    put_str(logger_name);
+    put_str(message);
+    put_u32(std::uint32_t(attr_count));
+    for_each_attr([&](attribute_view a) {
+        put_str(a.key);
+        put_str(a.value);
+    });
+}
+
+inline void encode_record(std::string& out, msg const& m)
+{
+    encode_record(out, m.timestamp, m.level, m.logger_name, m.message,
+        m.attr_count(), [&](auto&& f) { m.for_each_attr(f); });
+}
+
+// decodes a record produced by encode_record from the front of in, advancing
+// it past the record; returns false if in does not hold a complete record
+inline auto decode_record(std::string_view& in, msg& m) -> bool
+{
+    auto p = in;
+    auto get = [&](void* dst, std::size_t n) -> bool {
+        if (p.size() < n)
+            return false;
+        std::memcpy(dst, p.data(), n);
+        p.remove_prefix(n);
+        return true;
+    };
+    auto get_str = [&](std::string_view& sv) -> bool {
+        auto n = std::uint32_t{0};
+        if (!get(&n, sizeof(n)) || p.size() < n)
+            return false;
+        sv = p.substr(0, n);
+        p.remove_prefix(n);
+        return true;
+    };
+
+    auto ts = std::int64_t{0};
+    auto lv = std::uint8_t{0};
+    auto logger_name = std::string_view{};
+    auto message = std::string_view{};
+    auto count = std::uint32_t{0};
+    if (!get(&ts, sizeof(ts)) || !get(&lv, sizeof(lv)) ||
+        lv > std::uint8_t(level::critical) || !get_str(logger_name) ||
+        !get_str(message) || !get(&count, sizeof(count)))
+        return false;
+
+    m.timestamp = clock::time_point(std::chrono::duration_cast<
+        clock::duration>(std::chrono::nanoseconds(ts)));
+    m.level = level(lv);
+    m.logger_name.assign(logger_name);
+    m.message.assign(message);
+    m.attributes.clear();
+    m.context.reset();
+    for (std::uint32_t i = 0; i < count; ++i) {
+        auto k = std::string_view{};
+        auto v = std::string_view{};
+        if (!get_str(k) || !get_str(v))
+            return false;
+        m.attributes.emplace_back(k, v);
+    }
+    in = p;
+    return true;
+}
+
+} // namespace zappy::details
@@ -1,33 +1,114 @@
 #pragma once
 
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <memory>
+#include <new>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <zappy/details/fd-writer.hpp>
+#include <zappy/details/metrics.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace zappy {
+
+// when a file sink makes what it wrote durable, i.e. fdatasync()s it
+enum class durability {
+    none,         // left to the operating system
+    periodic,     // every sync_interval or sync_bytes, on flush
+    group_commit, // when asked to by core::sync, once for all waiters
+};
 
-namespace zappy::details {
+namespace details {
 
 struct rotating_file {
 public:
     struct policy {
         std::size_t max_size;
         std::size_t max_count;
+        durability sync = durability::none;
+        std::chrono::milliseconds sync_interval{1000};
+        std::size_t sync_bytes = 0; // 0 syncs on the interval only
+        // bypasses the page cache with O_DIRECT where the file system
+        // supports it, see direct_io
+        bool direct_io = false;
+        // the file is shared with other processes, see shared; overrides
+        // direct_io
+        bool shared = false;
     };
 
+    // data is written out once this much is buffered, and on flush
+    static constexpr std::size_t buffer_size = 64 * 1024;
+    // of direct I/O buffers, offsets and lengths
+    static constexpr std::size_t block_size = 4096;
+
+    // records the duration of every sync when set
+    latency_recorder* sync_latency = nullptr;
+
 private:
     policy policy_;
     std::string fn_base;
     std::string fn_ext;
 
     std::size_t file_size = 0;
-
-    std::ofstream strm;
+    std::size_t rotations_ = 0;
+    std::size_t syncs_ = 0;
+    std::size_t dropped_ = 0; // records, see write_out
+
+    int fd_ = -1;
+    std::string buffer_;
+    std::size_t pending_records_ = 0; // in buffer_
+
+    // direct I/O: data is collected in a block aligned buffer and written
+    // in whole blocks at direct_offset_; the partial block at the end is
+    // written zero padded on flush, kept, and written again once it is
+    // completed. The padding is trimmed when the file is closed
+    struct aligned_delete {
+        void operator()(char* p) const
+        {
+            ::operator delete[](p, std::align_val_t{block_size});
+        }
+    };
+    std::unique_ptr<char[], aligned_delete> direct_buffer_;
+    std::size_t direct_fill_ = 0;
+    std::size_t direct_offset_ = 0; // of direct_buffer_ in the file
+    bool direct_ = false; // fd_ is open with O_DIRECT
+
+    // shared files: every write_out is one O_APPEND write of whole records,
+    // at most buffer_size unless a single record is larger, so the records
+    // of processes appending to the file never interleave. file_size is
+    // the end of the last write. Rotation takes an flock on "<file>.lock",
+    // without waiting for it, and every process reopens the file once the
+    // path refers to another inode
+    int lock_fd_ = -1;
+    std::size_t unsynced_ = 0; // bytes written out since the last sync
+    std::chrono::steady_clock::time_point last_sync_ =
+        std::chrono::steady_clock::now();
 
     void open(bool truncate);
+    auto open_direct(std::filesystem::path const& fn, bool truncate) -> bool;
     void reopen(bool truncate);
     void rotate();
     void close();
+    void write_out();
+    void write_direct(std::string_view sv);
+    void write_out_direct();
+    void leave_direct();
+    void write_shared(std::string_view sv);
+    void rotate_shared();
+    void follow();
+    void sync_fd();
     auto make_fn(std::size_t number = 0) -> std::filesystem::path;
 
 public:
@@ -38,6 +119,15 @@ public:
 
     void write(std::string_view sv);
     void flush();
+
+    // writes out and syncs what was written so far, unless the policy is
+    // durability::none
+    void sync();
+
+    auto rotations() const -> std::size_t { return rotations_; }
+    auto syncs() const -> std::size_t { return syncs_; }
+    // records that could not be written out
+    auto dropped() const -> std::size_t { return dropped_; }
 };
 
 inline void decompose_fn(
@@ -68,49 +158,296 @@ inline rotating_file::rotating_file(
     : policy_{p}
 {
     decompose_fn(fn.string(), fn_base, fn_ext);
+    buffer_.reserve(buffer_size);
     open(false);
 }
 
 inline rotating_file::rotating_file(rotating_file&& f)
-    : policy_{f.policy_}
+    : sync_latency{f.sync_latency}
+    , policy_{f.policy_}
     , fn_base{f.fn_base}
     , fn_ext{f.fn_ext}
     , file_size{f.file_size}
-    , strm{std::move(f.strm)}
+    , rotations_{f.rotations_}
+    , syncs_{f.syncs_}
+    , dropped_{f.dropped_}
+    , fd_{f.fd_}
+    , buffer_{std::move(f.buffer_)}
+    , pending_records_{f.pending_records_}
+    , direct_buffer_{std::move(f.direct_buffer_)}
+    , direct_fill_{f.direct_fill_}
+    , direct_offset_{f.direct_offset_}
+    , direct_{f.direct_}
+    , lock_fd_{f.lock_fd_}
+    , unsynced_{f.unsynced_}
+    , last_sync_{f.last_sync_}
 {
     f.file_size = 0;
+    f.fd_ = -1;
+    f.direct_ = false;
+    f.lock_fd_ = -1;
 }
 
-inline rotating_file::~rotating_file() { close(); }
+inline rotating_file::~rotating_file()
+{
+    close();
+#ifndef _WIN32
+    if (lock_fd_ >= 0)
+        ::close(lock_fd_);
+#endif
+}
 
 inline void rotating_file::write(std::string_view sv)
 {
     if (sv.empty())
         return;
 
+    if (policy_.shared) {
+        write_shared(sv);
+        return;
+    }
+
     auto const sz = sv.size();
 
     if (policy_.max_count && file_size + sz > policy_.max_size &&
         file_size > 0) {
-        strm.flush();
         rotate();
     }
 
-    if (strm.is_open()) {
-        strm.write(sv.data(), sz);
+    if (direct_) {
+        write_direct(sv);
+        file_size += sz;
+    }
+    else if (fd_ >= 0) {
+        buffer_ += sv;
+        ++pending_records_;
         file_size += sz;
+        if (buffer_.size() >= buffer_size)
+            write_out();
+    }
+}
+
+inline auto pwrite_all(int fd, char const* p, std::size_t n,
+    std::size_t offset) -> std::size_t
+{
+    auto written = std::size_t{0};
+#ifndef _WIN32
+    while (written < n) {
+        auto const r = ::pwrite(fd, p + written, n - written,
+            off_t(offset + written));
+        if (r > 0)
+            written += std::size_t(r);
+        else if (r < 0 && errno == EINTR)
+            continue;
+        else
+            break;
+    }
+#endif
+    return written;
+}
+
+inline void rotating_file::write_direct(std::string_view sv)
+{
+    while (!sv.empty() && direct_) {
+        auto const n = std::min(sv.size(), buffer_size - direct_fill_);
+        std::memcpy(direct_buffer_.get() + direct_fill_, sv.data(), n);
+        direct_fill_ += n;
+        sv.remove_prefix(n);
+        if (direct_fill_ == buffer_size)
+            write_out_direct();
+    }
+    // the file system refused direct I/O
+    if (!sv.empty())
+        buffer_ += sv;
+}
+
+// writes the buffer, padded to whole blocks, and keeps the partial block
+inline void rotating_file::write_out_direct()
+{
+    if (!direct_fill_)
+        return;
+    auto const padded = (direct_fill_ + block_size - 1) / block_size *
+                        block_size;
+    std::memset(direct_buffer_.get() + direct_fill_, 0, padded - direct_fill_);
+    if (pwrite_all(fd_, direct_buffer_.get(), padded, direct_offset_) !=
+        padded) {
+        leave_direct();
+        return;
+    }
+    unsynced_ += padded;
+    auto const whole = direct_fill_ / block_size * block_size;
+    direct_fill_ -= whole;
+    direct_offset_ += whole;
+    std::memmove(
+        direct_buffer_.get(), direct_buffer_.get() + whole, direct_fill_);
+}
+
+// switches to buffered I/O after a failed direct write: the buffer is written
+// as it is and the padding trimmed
+inline void rotating_file::leave_direct()
+{
+    direct_ = false;
+#if defined(O_DIRECT) && !defined(_WIN32)
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+    auto const end = direct_offset_ + direct_fill_;
+    if (pwrite_all(fd_, direct_buffer_.get(), direct_fill_, direct_offset_) ==
+        direct_fill_)
+        unsynced_ += direct_fill_;
+    [[maybe_unused]] auto r = ::ftruncate(fd_, off_t(end));
+    ::lseek(fd_, off_t(end), SEEK_SET);
+#endif
+    direct_fill_ = 0;
+}
+
+inline void rotating_file::write_out()
+{
+    write_out_direct();
+    if (policy_.shared)
+        follow();
+    if (buffer_.empty() || fd_ < 0)
+        return;
+    auto const n = write_fd(fd_, buffer_, std::chrono::milliseconds{0});
+    unsynced_ += n;
+    buffer_.erase(0, n);
+    if (buffer_.empty())
+        pending_records_ = 0;
+    else if (buffer_.size() >= buffer_size) {
+        // the file keeps failing (ENOSPC, EIO); a shorter rest is written
+        // again on the next write out, a whole buffer is given up on
+        dropped_ += pending_records_;
+        buffer_.clear();
+        pending_records_ = 0;
+    }
+#ifndef _WIN32
+    if (policy_.shared) {
+        auto const end = ::lseek(fd_, 0, SEEK_CUR);
+        file_size = end < 0 ? 0 : std::size_t(end);
+        if (policy_.max_count && file_size >= policy_.max_size)
+            rotate_shared();
     }
+#endif
+}
+
+inline void rotating_file::write_shared(std::string_view sv)
+{
+    if (!buffer_.empty() && buffer_.size() + sv.size() > buffer_size)
+        write_out();
+    if (fd_ >= 0) {
+        buffer_ += sv;
+        ++pending_records_;
+    }
+}
+
+// reopens the file if another process rotated it
+inline void rotating_file::follow()
+{
+#ifndef _WIN32
+    if (fd_ < 0)
+        return;
+    struct stat path_st, fd_st;
+    auto const fn = make_fn();
+    if (::stat(fn.c_str(), &path_st) == 0 && ::fstat(fd_, &fd_st) == 0 &&
+        path_st.st_dev == fd_st.st_dev && path_st.st_ino == fd_st.st_ino)
+        return;
+    auto const fd =
+        ::open(fn.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    if (policy_.sync != durability::none)
+        sync_fd();
+    ::close(fd_);
+    fd_ = fd;
+    unsynced_ = 0;
+    auto const end = ::lseek(fd_, 0, SEEK_END);
+    file_size = end < 0 ? 0 : std::size_t(end);
+#endif
+}
+
+inline void rotating_file::rotate_shared()
+{
+#ifndef _WIN32
+    if (policy_.max_count < 2)
+        return;
+    if (lock_fd_ < 0)
+        lock_fd_ = ::open((fn_base + fn_ext + ".lock").c_str(),
+            O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    // another process is rotating, it is followed on the next write
+    if (lock_fd_ < 0 || ::flock(lock_fd_, LOCK_EX | LOCK_NB) != 0)
+        return;
+
+    // unless another process rotated it after our last write
+    struct stat path_st, fd_st;
+    auto const fn = make_fn();
+    if (::stat(fn.c_str(), &path_st) == 0 && ::fstat(fd_, &fd_st) == 0 &&
+        path_st.st_dev == fd_st.st_dev && path_st.st_ino == fd_st.st_ino) {
+        ++rotations_;
+        for (auto i = policy_.max_count - 1; i > 0; --i) {
+            auto src = make_fn(i - 1);
+            if (std::filesystem::exists(src))
+                rename_file(src, make_fn(i));
+        }
+    }
+    ::flock(lock_fd_, LOCK_UN);
+    follow();
+#endif
+}
+
+inline void rotating_file::sync_fd()
+{
+    if (fd_ < 0 || !unsynced_)
+        return;
+    auto const t0 = std::chrono::steady_clock::now();
+#if defined(_WIN32)
+    ::_commit(fd_);
+#elif defined(__APPLE__)
+    ::fsync(fd_);
+#else
+    ::fdatasync(fd_);
+#endif
+    last_sync_ = std::chrono::steady_clock::now();
+    unsynced_ = 0;
+    ++syncs_;
+    if (sync_latency)
+        sync_latency->record(last_sync_ - t0);
 }
 
 inline void rotating_file::flush()
 {
-    strm.flush();
+    write_out();
+    if (policy_.sync != durability::periodic || !unsynced_)
+        return;
+    if (std::chrono::steady_clock::now() - last_sync_ >=
+            policy_.sync_interval ||
+        (policy_.sync_bytes && unsynced_ >= policy_.sync_bytes))
+        sync_fd();
+}
+
+inline void rotating_file::sync()
+{
+    write_out();
+    if (policy_.sync != durability::none)
+        sync_fd();
 }
 
 inline void rotating_file::close()
 {
+    auto const size = file_size;
     file_size = 0;
-    strm.close();
+    if (fd_ < 0)
+        return;
+    sync();
+#ifdef _WIN32
+    ::_close(fd_);
+#else
+    if (direct_) {
+        [[maybe_unused]] auto r = ::ftruncate(fd_, off_t(size));
+        direct_ = false;
+        direct_fill_ = 0;
+    }
+    ::close(fd_);
+#endif
+    fd_ = -1;
+    unsynced_ = 0;
 }
 
 inline auto rotating_file::make_fn(std::size_t number) -> std::filesystem::path
@@ -133,7 +470,7 @@ inline void rotating_file::open(bool truncate)
 
     auto const fn = make_fn();
 
-    for (int tries = 0; tries < open_tries; ++tries) {
+    for (std::size_t tries = 0; tries < open_tries; ++tries) {
         auto ec = std::error_code{};
         std::filesystem::create_directories(fn.parent_path(), ec);
         if (ec != std::error_code()) {
@@ -141,33 +478,93 @@ inline void rotating_file::open(bool truncate)
             continue;
         }
 
-        if (truncate) {
-            auto tmp = std::ofstream{fn, std::ios::out | std::ios::binary};
-            if (!tmp.is_open()) {
-                std::this_thread::sleep_for(open_interval);
-                continue;
-            }
-            tmp.close();
-        }
-
-        strm.open(fn, std::ios::out | std::ios::app | std::ios::binary);
-        if (!strm.is_open()) {
+#ifdef _WIN32
+        fd_ = ::_wopen(fn.c_str(),
+            _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY |
+                (truncate ? _O_TRUNC : 0),
+            _S_IREAD | _S_IWRITE);
+#else
+        // other processes may have written to a shared file already
+        if (policy_.shared)
+            truncate = false;
+        else if (policy_.direct_io && open_direct(fn, truncate))
+            return;
+        fd_ = ::open(fn.c_str(),
+            O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC |
+                (truncate ? O_TRUNC : 0),
+            0644);
+#endif
+        if (fd_ < 0) {
             std::this_thread::sleep_for(open_interval);
             continue;
         }
 
-        file_size = std::filesystem::file_size(fn);
+        file_size = std::filesystem::file_size(fn, ec);
+        if (ec)
+            file_size = 0;
         return;
     }
 }
 
-inline void rotating_file::reopen(bool truncate) { open(true); }
+inline auto rotating_file::open_direct(
+    std::filesystem::path const& fn, bool truncate) -> bool
+{
+#if defined(O_DIRECT) && !defined(_WIN32)
+    // file systems without direct I/O (tmpfs, some network file systems)
+    // fail with EINVAL, the file is then opened for buffered writes
+    fd_ = ::open(fn.c_str(),
+        O_RDWR | O_CREAT | O_DIRECT | O_CLOEXEC | (truncate ? O_TRUNC : 0),
+        0644);
+    if (fd_ < 0)
+        return false;
+
+    struct stat st;
+    file_size = ::fstat(fd_, &st) == 0 ? std::size_t(st.st_size) : 0;
+    if (!direct_buffer_)
+        direct_buffer_.reset(static_cast<char*>(
+            ::operator new[](buffer_size, std::align_val_t{block_size})));
+    direct_ = true;
+    // the last block of an existing file is read and written again; after a
+    // crash it still ends in the zero padding of the last flush, which is
+    // trimmed; records end in a newline, so the padding stops there
+    direct_offset_ = file_size ? (file_size - 1) / block_size * block_size : 0;
+    direct_fill_ = file_size - direct_offset_;
+    if (direct_fill_ &&
+        ::pread(fd_, direct_buffer_.get(), block_size, off_t(direct_offset_)) <
+            ssize_t(direct_fill_)) {
+        ::close(fd_);
+        fd_ = -1;
+        direct_ = false;
+        direct_fill_ = 0;
+        return false;
+    }
+    while (direct_fill_ && !direct_buffer_[direct_fill_ - 1])
+        --direct_fill_;
+    if (direct_offset_ + direct_fill_ < file_size) {
+        file_size = direct_offset_ + direct_fill_;
+        [[maybe_unused]] auto r = ::ftruncate(fd_, off_t(file_size));
+    }
+#ifdef __linux__
+    // whole segments are allocated up front, the size is left alone
+    if (policy_.max_count && policy_.max_size > file_size)
+        ::fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, off_t(policy_.max_size));
+#endif
+    return true;
+#else
+    (void)fn;
+    (void)truncate;
+    return false;
+#endif
+}
+
+inline void rotating_file::reopen(bool truncate) { open(truncate); }
 
 inline void rotating_file::rotate()
 {
     if (policy_.max_count < 2)
         return;
 
+    ++rotations_;
     close();
     for (auto i = policy_.max_count - 1; i > 0; --i) {
         auto src = make_fn(i - 1);
@@ -185,4 +582,6 @@ inline void rotating_file::rotate()
     reopen(true);
 }
 
-} // namespace zappy::details
\ No newline at end of file
+} // namespace details
+
+} // namespace zappy
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <zappy/details/common.hpp>
+
+namespace zappy::details {
+
+// the sinks records of a logger at one level go to: those in sinks take every
+// record, those in check only the records their filters accept
+struct route_masks {
+    std::uint64_t sinks = 0;
+    std::uint64_t check = 0;
+
+    explicit operator bool() const { return (sinks | check) != 0; }
+};
+
+// route_table interns logger names into small ids and keeps, per logger id
+// and level, the bit mask of the sinks its records go to. Rows are filled in
+// by the core and recomputed when its configuration epoch moves on; looking
+// up a row takes no lock
+struct route_table {
+    static constexpr std::size_t max_sinks = 64;
+    static constexpr std::size_t level_count = 5;
+
+    struct row {
+        std::string logger_name; // set once when interned
+        std::atomic<std::uint64_t> epoch{~std::uint64_t{0}};
+        // seqlock over sinks and check, odd while they are being rewritten
+        std::atomic<std::uint32_t> seq{0};
+        std::array<std::atomic<std::uint64_t>, level_count> sinks{};
+        std::array<std::atomic<std::uint64_t>, level_count> check{};
+    };
+
+private:
+    static constexpr std::size_t chunk_bits = 8;
+    static constexpr std::size_t chunk_size = std::size_t{1} << chunk_bits;
+    static constexpr std::size_t max_chunks = 4096;
+
+    // rows never move, chunks are published once and freed with the table
+    std::array<std::atomic<row*>, max_chunks> chunks_{};
+    std::mutex mux_; // guards ids_ and next_
+    std::unordered_map<std::string, std::uint32_t> ids_;
+    std::uint32_t next_ = 1; // 0 stands for "not interned"
+
+public:
+    // serializes the rebuilding of rows
+    std::mutex rebuild_mux;
+
+    route_table() = default;
+    route_table(route_table const&) = delete;
+
+    ~route_table()
+    {
+        for (auto& c : chunks_)
+            delete[] c.load(std::memory_order_relaxed);
+    }
+
+    // returns the id of a logger name, or 0 once the table is full
+    auto intern(std::string_view name) -> std::uint32_t
+    {
+        auto _ = std::unique_lock(mux_);
+        auto key = std::string(name);
+        if (auto it = ids_.find(key); it != ids_.end())
+            return it->second;
+
+        auto const id = next_;
+        auto const chunk = id >> chunk_bits;
+        if (chunk >= max_chunks)
+            return 0;
+        auto c = chunks_[chunk].load(std::memory_order_relaxed);
+        if (!c) {
+            c = new row[chunk_size];
+            chunks_[chunk].store(c, std::memory_order_release);
+        }
+        c[id & (chunk_size - 1)].logger_name = key;
+        ids_.emplace(std::move(key), id);
+        ++next_;
+        return id;
+    }
+
+    auto find(std::uint32_t id) const -> row*
+    {
+        if (!id || (id >> chunk_bits) >= max_chunks)
+            return nullptr;
+        auto c = chunks_[id >> chunk_bits].load(std::memory_order_acquire);
+        return c ? &c[id & (chunk_size - 1)] : nullptr;
+    }
+};
+
+} // namespace zappy::details
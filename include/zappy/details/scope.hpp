@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <zappy/details/common.hpp>
+#include <zappy/details/core.hpp>
+#include <zappy/details/record-codec.hpp>
+
+namespace zappy {
+
+// log_scope holds back the records logged on its thread, into its core,
+// while it is the innermost scope: they are kept encoded in a thread-local
+// buffer instead of being queued. They reach the core when the scope is
+// committed, or when a trigger record (error and up by default) arrives;
+// otherwise they are dropped when the scope ends, which only truncates the
+// buffer. After a commit the records of the scope are passed through.
+//
+//   auto s = lg.scope();
+//   ...
+//   s.commit_if_error();
+//
+// Scopes nest and must end in the reverse order of their creation, on the
+// thread that created them
+struct log_scope {
+private:
+    std::shared_ptr<core> core_;
+    level_filter trigger_;
+    log_scope* parent_;
+    std::size_t start_; // of the records of this scope in buffer()
+    bool committed_ = false;
+    bool failed_ = false; // an error or critical record was logged
+
+    inline static thread_local log_scope* top_ = nullptr;
+
+    // records of all scopes of the thread, each prefixed by its u32 logger
+    // id; it keeps its capacity from scope to scope
+    static auto buffer() -> std::string&
+    {
+        thread_local auto b = std::string{};
+        return b;
+    }
+
+    // queues the records buffered from this scope on, innermost scopes
+    // included, and passes their future records through
+    void send();
+
+public:
+    explicit log_scope(std::shared_ptr<core> c,
+        level_filter&& trigger = levels(level::error, level::critical))
+        : core_{std::move(c)}
+        , trigger_{std::move(trigger)}
+        , parent_{top_}
+        , start_{buffer().size()}
+    {
+        top_ = this;
+    }
+
+    log_scope(log_scope const&) = delete;
+    auto operator=(log_scope const&) -> log_scope& = delete;
+
+    ~log_scope()
+    {
+        discard();
+        top_ = parent_;
+    }
+
+    // queues the records held back so far, later records are passed through
+    void commit()
+    {
+        if (!committed_)
+            send();
+    }
+
+    // commits if an error or critical record was logged in the scope,
+    // discards otherwise; returns whether it committed
+    auto commit_if_error() -> bool
+    {
+        if (failed_)
+            commit();
+        else
+            discard();
+        return failed_;
+    }
+
+    // drops the records held back so far
+    void discard()
+    {
+        auto& b = buffer();
+        if (!committed_ && b.size() > start_)
+            b.resize(start_);
+    }
+
+    auto failed() const -> bool { return failed_; }
+
+    // bytes held back by this scope and the scopes inside it
+    auto size_bytes() const -> std::size_t
+    {
+        return committed_ ? 0 : buffer().size() - start_;
+    }
+
+    // called by loggers for every record they pass to c, encode appends the
+    // encoded record to a string; returns true if the record was held back
+    template <typename Encode>
+    static auto capture(core const& c, std::uint32_t logger_id, level l,
+        Encode&& encode) -> bool
+    {
+        auto s = top_;
+        if (!s || s->core_.get() != &c)
+            return false;
+        if (l >= level::error)
+            for (auto p = s; p; p = p->parent_)
+                p->failed_ = true;
+        if (s->committed_)
+            return false;
+        if (s->trigger_(l)) {
+            // the record itself is queued by the caller, after the others
+            auto outer = s;
+            while (outer->parent_ && !outer->parent_->committed_ &&
+                   outer->parent_->core_ == s->core_)
+                outer = outer->parent_;
+            outer->send();
+            return false;
+        }
+
+        auto& b = buffer();
+        char id[sizeof(logger_id)];
+        std::memcpy(id, &logger_id, sizeof(logger_id));
+        b.append(id, sizeof(id));
+        encode(b);
+        return true;
+    }
+};
+
+inline void log_scope::send()
+{
+    auto& b = buffer();
+    auto in = std::string_view(b).substr(std::min(start_, b.size()));
+    auto m = msg{};
+    auto id = std::uint32_t{0};
+    while (in.size() >= sizeof(id)) {
+        std::memcpy(&id, in.data(), sizeof(id));
+        in.remove_prefix(sizeof(id));
+        if (!details::decode_record(in, m))
+            break;
+        core_->write(std::move(m), id);
+    }
+    if (b.size() > start_)
+        b.resize(start_);
+    for (auto s = top_; s; s = s->parent_) {
+        s->committed_ = true;
+        if (s == this)
+            break;
+    }
+}
+
+} // namespace zappy
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace zappy::details {
+
+// shm_ring is a single-producer single-consumer byte ring in POSIX shared
+// memory, used to hand encoded records to another process
+//
+// frames are a u32 length followed by the payload; the producer publishes a
+// frame by advancing head (release), the consumer releases space by
+// advancing tail; both positions grow monotonically and are masked into the
+// data area, so the two processes never take a lock. frames published before
+// the producer dies stay readable. A frame whose length runs past head can
+// only be corrupt; the consumer then skips everything up to head and counts
+// the bytes as lost
+//
+// a ring must have at most one producer and one consumer process
+struct shm_ring {
+    static constexpr std::uint64_t magic = 0x676e69722d79707aull; // "zpy-ring"
+    static constexpr std::uint32_t version = 2;
+
+    struct header {
+        std::atomic<std::uint64_t> magic;
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::uint64_t capacity;
+        alignas(64) std::atomic<std::uint64_t> head;
+        alignas(64) std::atomic<std::uint64_t> tail;
+        std::atomic<std::uint64_t> lost; // bytes skipped by the consumer
+        alignas(64) std::atomic<std::uint64_t> dropped;
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+    static constexpr std::size_t data_offset = (sizeof(header) + 63) / 64 * 64;
+
+private:
+    header* hdr_ = nullptr;
+    char* data_ = nullptr;
+    std::size_t mapped_size_ = 0;
+    std::uint64_t mask_ = 0;
+    std::string scratch_;
+
+    auto map(int fd, std::size_t size) -> bool;
+    void copy_in(std::uint64_t pos, void const* src, std::size_t n);
+    void copy_out(std::uint64_t pos, void* dst, std::size_t n) const;
+
+public:
+    shm_ring() = default;
+    shm_ring(shm_ring const&) = delete;
+    ~shm_ring() { close(); }
+
+    // creates the ring (or reuses an existing compatible one) as a producer;
+    // capacity is rounded up to a power of two, an existing ring keeps its
+    // own
+    auto create(std::string const& name, std::size_t capacity) -> bool;
+
+    // attaches to an initialized ring as a consumer
+    auto open(std::string const& name) -> bool;
+
+    void close();
+
+    auto is_open() const -> bool { return hdr_ != nullptr; }
+
+    // producer side: publishes one frame, returns false if it does not fit
+    auto try_write(std::string_view payload) -> bool;
+
+    // consumer side: invokes callback(std::string_view) for every published
+    // frame, releasing their space afterwards; returns the number of frames
+    template <typename Callback> auto read(Callback&& callback) -> std::size_t;
+
+    auto dropped() const -> std::uint64_t
+    {
+        return hdr_ ? hdr_->dropped.load(std::memory_order_relaxed) : 0;
+    }
+
+    auto lost() const -> std::uint64_t
+    {
+        return hdr_ ? hdr_->lost.load(std::memory_order_relaxed) : 0;
+    }
+};
+
+inline auto shm_ring::map(int fd, std::size_t size) -> bool
+{
+    auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+    hdr_ = static_cast<header*>(p);
+    data_ = static_cast<char*>(p) + data_offset;
+    mapped_size_ = size;
+    return true;
+}
+
+inline auto shm_ring::create(std::string const& name, std::size_t capacity)
+    -> bool
+{
+    close();
+    capacity = std::bit_ceil(std::max<std::size_t>(capacity, 4096));
+    auto size = data_offset + capacity;
+
+    auto fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    auto fresh = fd >= 0;
+    if (!fresh && errno == EEXIST)
+        fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+
+    // a consumer may have mapped a segment that existed already, resizing it
+    // would fault its reads: it is only sized if it is too small to have
+    // been opened, left by a producer that died creating it
+    struct stat st;
+    auto ok = ::fstat(fd, &st) == 0;
+    if (ok && std::size_t(st.st_size) <= data_offset) {
+        fresh = true;
+        ok = ::ftruncate(fd, off_t(size)) == 0;
+    }
+    else if (ok) {
+        size = std::size_t(st.st_size);
+        capacity = size - data_offset;
+        ok = std::has_single_bit(capacity);
+    }
+    ok = ok && map(fd, size);
+    ::close(fd);
+    if (!ok)
+        return false;
+
+    if (fresh || hdr_->magic.load(std::memory_order_acquire) != magic ||
+        hdr_->version != version || hdr_->capacity != capacity) {
+        hdr_->magic.store(0, std::memory_order_relaxed);
+        hdr_->version = version;
+        hdr_->capacity = capacity;
+        hdr_->head.store(0, std::memory_order_relaxed);
+        hdr_->tail.store(0, std::memory_order_relaxed);
+        hdr_->lost.store(0, std::memory_order_relaxed);
+        hdr_->dropped.store(0, std::memory_order_relaxed);
+        hdr_->magic.store(magic, std::memory_order_release);
+    }
+    mask_ = capacity - 1;
+    return true;
+}
+
+inline auto shm_ring::open(std::string const& name) -> bool
+{
+    close();
+    auto fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    auto ok = ::fstat(fd, &st) == 0 &&
+              std::size_t(st.st_size) > data_offset &&
+              map(fd, std::size_t(st.st_size));
+    ::close(fd);
+    if (!ok)
+        return false;
+
+    if (hdr_->magic.load(std::memory_order_acquire) != magic ||
+        hdr_->version != version ||
+        data_offset + hdr_->capacity != mapped_size_ ||
+        !std::has_single_bit(hdr_->capacity)) {
+        close();
+        return false;
+    }
+    mask_ = hdr_->capacity - 1;
+    return true;
+}
+
+inline void shm_ring::close()
+{
+    if (hdr_)
+        ::munmap(hdr_, mapped_size_);
+    hdr_ = nullptr;
+    data_ = nullptr;
+    mapped_size_ = 0;
+}
+
+inline void shm_ring::copy_in(std::uint64_t pos, void const* src, std::size_t n)
+{
+    auto const off = std::size_t(pos & mask_);
+    auto const first = std::min(n, std::size_t(mask_ + 1) - off);
+    std::memcpy(data_ + off, src, first);
+    std::memcpy(data_, static_cast<char const*>(src) + first, n - first);
+}
+
+inline void shm_ring::copy_out(std::uint64_t pos, void* dst, std::size_t n) const
+{
+    auto const off = std::size_t(pos & mask_);
+    auto const first = std::min(n, std::size_t(mask_ + 1) - off);
+    std::memcpy(dst, data_ + off, first);
+    std::memcpy(static_cast<char*>(dst) + first, data_, n - first);
+}
+
+inline auto shm_ring::try_write(std::string_view payload) -> bool
+{
+    if (!hdr_)
+        return false;
+    auto const len = std::uint32_t(payload.size());
+    auto const frame = sizeof(len) + payload.size();
+    auto const head = hdr_->head.load(std::memory_order_relaxed);
+    auto const tail = hdr_->tail.load(std::memory_order_acquire);
+    if (frame > hdr_->capacity - (head - tail)) {
+        hdr_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    copy_in(head, &len, sizeof(len));
+    copy_in(head + sizeof(len), payload.data(), payload.size());
+    hdr_->head.store(head + frame, std::memory_order_release);
+    return true;
+}
+
+template <typename Callback>
+auto shm_ring::read(Callback&& callback) -> std::size_t
+{
+    if (!hdr_)
+        return 0;
+    auto const head = hdr_->head.load(std::memory_order_acquire);
+    auto tail = hdr_->tail.load(std::memory_order_relaxed);
+    auto n = std::size_t{0};
+    while (head - tail >= sizeof(std::uint32_t)) {
+        auto len = std::uint32_t{0};
+        copy_out(tail, &len, sizeof(len));
+        if (head - tail - sizeof(len) < len) {
+            // corrupt, the next frame starts at head
+            hdr_->lost.fetch_add(head - tail, std::memory_order_relaxed);
+            hdr_->tail.store(head, std::memory_order_release);
+            break;
+        }
+        auto const pos = tail + sizeof(len);
+        auto const off = std::size_t(pos & mask_);
+        if (off + len <= mask_ + 1) {
+            callback(std::string_view(data_ + off, len));
+        }
+        else {
+            scratch_.resize(len);
+            copy_out(pos, scratch_.data(), len);
+            callback(std::string_view(scratch_));
+        }
+        tail = pos + len;
+        hdr_->tail.store(tail, std::memory_order_release);
+        ++n;
+    }
+    return n;
+}
+
+} // namespace zappy::details
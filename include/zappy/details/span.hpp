@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+namespace zappy::details {
+
+// attributes of span records, read back by trace_event_sink
+inline constexpr std::string_view span_duration_key = "duration_ns";
+inline constexpr std::string_view span_id_key = "span_id";
+inline constexpr std::string_view span_parent_key = "parent_id";
+inline constexpr std::string_view span_thread_key = "thread";
+
+// span ids are the index of the thread in the upper and a per-thread counter
+// in the lower 32 bits, so taking one is not contended
+struct span_ids {
+    std::uint32_t thread = 0;
+    std::uint32_t last = 0;
+    std::uint64_t current = 0; // innermost open span of the thread, or 0
+
+    static auto get() -> span_ids&
+    {
+        static auto threads = std::atomic<std::uint32_t>{0};
+        thread_local auto ids = span_ids{
+            .thread = threads.fetch_add(1, std::memory_order_relaxed) + 1};
+        return ids;
+    }
+
+    auto next() -> std::uint64_t
+    {
+        return std::uint64_t(thread) << 32 | ++last;
+    }
+};
+
+// writes v into buf, returns the text
+template <std::size_t N>
+inline auto number_sv(char (&buf)[N], std::uint64_t v) -> std::string_view
+{
+    auto const r = std::to_chars(buf, buf + N, v);
+    return {buf, std::size_t(r.ptr - buf)};
+}
+
+} // namespace zappy::details
@@ -39,6 +39,26 @@ inline auto to_sv(level v, bool upper_case = false) -> std::string_view
     }
 }
 
+// parses a level name as produced by to_sv (case-insensitive)
+inline auto from_sv(std::string_view s, level& v) -> bool
+{
+    static constexpr level all[] = {level::debug, level::info, level::warn,
+        level::error, level::critical};
+    for (auto l : all) {
+        auto const name = to_sv(l);
+        if (name.size() != s.size())
+            continue;
+        auto match = true;
+        for (std::size_t i = 0; match && i < s.size(); ++i)
+            match = (s[i] | 0x20) == name[i];
+        if (match) {
+            v = l;
+            return true;
+        }
+    }
+    return false;
+}
+
 inline auto to_chars(char* first, char* last, level v, bool upper_case = false)
     -> std::to_chars_result
 {
@@ -98,6 +98,15 @@ inline auto is_terminal(std::streambuf const* osbuf) -> bool
     return false;
 }
 
+inline auto is_terminal(int fd) -> bool
+{
+#ifdef _WIN32
+    return _isatty(fd) || is_msys_pty(fd);
+#else
+    return isatty(fd) != 0;
+#endif
+}
+
 inline auto is_color_terminal() -> bool
 {
 #ifdef _WIN32
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <zappy/details/common.hpp>
+
+namespace zappy {
+
+enum class throttle_scope {
+    logger,  // one token bucket per logger name
+    message, // one token bucket per logger name + message text
+};
+
+// throttle decides, before a record is queued, whether it is let through;
+// records are dropped by:
+//
+//  - 1-in-N sampling per level
+//  - suppression of identical records (same logger, level and message) seen
+//    again within a window; once the window ends, or another record takes
+//    its slot, a copy of the first suppressed record is written in their
+//    place with a "repeated" attribute holding the number of copies (see
+//    take_summaries)
+//  - token-bucket rate limiting per logger or per message
+//
+// records are keyed by a hash into fixed-size tables of atomic slots, so the
+// check costs a hash and a few atomics; colliding keys share a rate bucket
+// and cut short each other's suppression windows. A window is started with
+// a compare-and-swap, only keeping the first suppressed copy of a window
+// for its summary takes a lock. Copies suppressed while a window of the
+// same slot starts may be counted in the summary of its neighbour
+//
+// all settings may be changed while logging is in progress
+struct throttle {
+private:
+    static constexpr std::size_t table_size = 1024;
+    static constexpr std::size_t level_count = 5;
+
+    struct dedupe_slot {
+        std::atomic<std::uint64_t> key{0};
+        std::atomic<std::int64_t> window_start{0};
+        std::atomic<std::uint64_t> repeats{0}; // of the current window
+        // of the windows later ones took the slot from, not yet summarized
+        std::atomic<std::uint64_t> displaced{0};
+    };
+
+    std::atomic<bool> active_{false};
+
+    std::array<std::atomic<std::uint32_t>, level_count> sample_n_{};
+    std::array<std::atomic<std::uint32_t>, level_count> sample_seq_{};
+
+    std::atomic<std::int64_t> dedupe_window_{0};
+    std::array<dedupe_slot, table_size> dedupe_{};
+
+    // the first suppressed copy of the window of a slot, for its summary
+    struct stashed {
+        std::uint64_t key;
+        msg record;
+    };
+    std::mutex dedupe_mux_; // guards stash_ and summaries_
+    std::array<std::unique_ptr<stashed>, table_size> stash_{};
+    std::vector<msg> summaries_; // of closed windows, not yet taken
+    // windows with suppressed copies, and summaries not yet taken
+    std::atomic<std::size_t> pending_{0};
+
+    // generic cell rate algorithm: a bucket is represented by its theoretical
+    // arrival time, a record is admitted if it does not run ahead of it by
+    // more than the burst tolerance
+    std::atomic<std::int64_t> emission_interval_{0};
+    std::atomic<std::int64_t> burst_tolerance_{0};
+    std::atomic<throttle_scope> rate_scope_{throttle_scope::message};
+    std::array<std::atomic<std::int64_t>, table_size> tat_{};
+
+    static auto now_ns() -> std::int64_t
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static auto hash(msg const& m, bool with_message) -> std::uint64_t
+    {
+        auto h = std::uint64_t(std::hash<std::string_view>{}(m.logger_name));
+        if (with_message) {
+            h ^= std::uint64_t(std::hash<std::string_view>{}(m.message)) +
+                 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+            h = h * 31 + std::uint64_t(m.level);
+        }
+        return h | 1; // 0 marks an unused slot
+    }
+
+    void update_active()
+    {
+        auto on = dedupe_window_.load(std::memory_order_relaxed) > 0 ||
+                  emission_interval_.load(std::memory_order_relaxed) > 0;
+        for (auto const& n : sample_n_)
+            on = on || n.load(std::memory_order_relaxed) > 1;
+        active_.store(on, std::memory_order_relaxed);
+    }
+
+    auto sampled_out(level l) -> bool;
+    auto suppressed(msg const& m, std::int64_t now) -> bool;
+    // keeps m, the first suppressed copy of the window of slot i
+    void stash(std::size_t i, std::uint64_t key, msg const& m);
+    // moves the stashed record of slot i with the number of its copies to
+    // summaries_; must be called with dedupe_mux_ locked
+    void close_window(std::size_t i, std::uint64_t repeats);
+    auto rate_limited(msg const& m, std::int64_t now) -> bool;
+
+public:
+    throttle() = default;
+    throttle(throttle const&) = delete;
+
+    // keeps 1 in n records of the given level, n <= 1 disables sampling
+    void sample(level l, std::uint32_t n)
+    {
+        sample_n_[std::size_t(l)].store(n, std::memory_order_relaxed);
+        update_active();
+    }
+
+    // drops identical records seen again within the window, a zero window
+    // disables suppression
+    void suppress_duplicates(std::chrono::milliseconds window)
+    {
+        dedupe_window_.store(
+            std::chrono::nanoseconds(window).count(), std::memory_order_relaxed);
+        update_active();
+    }
+
+    // lets through on average per_second records, with bursts of up to burst
+    // records, per_second <= 0 disables rate limiting
+    void rate_limit(double per_second, std::size_t burst = 1,
+        throttle_scope scope = throttle_scope::message)
+    {
+        auto const interval =
+            per_second > 0 ? std::int64_t(1e9 / per_second) : 0;
+        rate_scope_.store(scope, std::memory_order_relaxed);
+        burst_tolerance_.store(
+            interval * std::int64_t(burst ? burst - 1 : 0),
+            std::memory_order_relaxed);
+        emission_interval_.store(interval, std::memory_order_relaxed);
+        update_active();
+    }
+
+    // false while no sampling, suppression or rate limit is configured
+    auto active() const -> bool
+    {
+        return active_.load(std::memory_order_relaxed);
+    }
+
+    // returns false if the record must be dropped
+    auto admit(msg const& m) -> bool
+    {
+        if (!active_.load(std::memory_order_relaxed))
+            return true;
+        if (sampled_out(m.level))
+            return false;
+        auto const now = now_ns();
+        return !suppressed(m, now) && !rate_limited(m, now);
+    }
+
+    // calls f with the summary record of every suppression window that has
+    // ended, or of every window with suppressed copies if all is set; the
+    // summaries are not subject to sampling or rate limiting
+    template <typename F> void take_summaries(F&& f, bool all = false);
+};
+
+inline auto throttle::sampled_out(level l) -> bool
+{
+    auto const i = std::size_t(l);
+    auto const n = sample_n_[i].load(std::memory_order_relaxed);
+    if (n <= 1)
+        return false;
+    return sample_seq_[i].fetch_add(1, std::memory_order_relaxed) % n != 0;
+}
+
+inline auto throttle::suppressed(msg const& m, std::int64_t now) -> bool
+{
+    auto const window = dedupe_window_.load(std::memory_order_relaxed);
+    if (window <= 0)
+        return false;
+
+    auto const key = hash(m, true);
+    auto const i = key % table_size;
+    auto& slot = dedupe_[i];
+    auto k = slot.key.load(std::memory_order_acquire);
+    auto start = slot.window_start.load(std::memory_order_acquire);
+    if (k == key && now - start < window) {
+        if (slot.repeats.fetch_add(1, std::memory_order_relaxed))
+            return true;
+        stash(i, key, m);
+        return true;
+    }
+
+    // a new window starts with this record. Of records racing for the slot,
+    // the one that swaps the key, or the start for the same key, starts it,
+    // the others are let through. The copies of the window it displaces are
+    // left to take_summaries
+    if (k != key) {
+        if (!slot.key.compare_exchange_strong(
+                k, key, std::memory_order_acq_rel))
+            return false;
+        slot.window_start.store(now, std::memory_order_release);
+    }
+    else if (!slot.window_start.compare_exchange_strong(
+                 start, now, std::memory_order_acq_rel))
+        return false;
+    if (auto const n = slot.repeats.exchange(0, std::memory_order_relaxed))
+        slot.displaced.fetch_add(n, std::memory_order_relaxed);
+    return false;
+}
+
+inline void throttle::stash(std::size_t i, std::uint64_t key, msg const& m)
+{
+    auto _ = std::unique_lock(dedupe_mux_);
+    // the record of a window displaced meanwhile is summarized first
+    auto const displaced =
+        dedupe_[i].displaced.exchange(0, std::memory_order_relaxed);
+    if (stash_[i] && (displaced || stash_[i]->key != key))
+        close_window(i, displaced);
+    else if (displaced)
+        dedupe_[i].displaced.fetch_add(displaced, std::memory_order_relaxed);
+    if (stash_[i])
+        return;
+    stash_[i].reset(new stashed{key, m});
+    pending_.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void throttle::close_window(std::size_t i, std::uint64_t repeats)
+{
+    auto st = std::move(stash_[i]);
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    if (!repeats)
+        return;
+    st->record.add_attr("repeated", std::to_string(repeats));
+    summaries_.push_back(std::move(st->record));
+    pending_.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename F> void throttle::take_summaries(F&& f, bool all)
+{
+    if (!pending_.load(std::memory_order_relaxed))
+        return;
+    auto const window = dedupe_window_.load(std::memory_order_relaxed);
+    auto const now = now_ns();
+    auto taken = std::vector<msg>{};
+    {
+        auto _ = std::unique_lock(dedupe_mux_);
+        for (std::size_t i = 0; i < table_size; ++i) {
+            if (!stash_[i])
+                continue;
+            auto& slot = dedupe_[i];
+            // the stashed record is of a displaced window, or of the current
+            // one if it ended; a window being displaced is left for later
+            if (auto const n =
+                    slot.displaced.exchange(0, std::memory_order_relaxed))
+                close_window(i, n);
+            else if (stash_[i]->key !=
+                     slot.key.load(std::memory_order_acquire))
+                continue;
+            else if (all || window <= 0 ||
+                     now - slot.window_start.load(
+                               std::memory_order_acquire) >=
+                         window)
+                close_window(
+                    i, slot.repeats.exchange(0, std::memory_order_relaxed));
+        }
+        pending_.fetch_sub(summaries_.size(), std::memory_order_relaxed);
+        taken.swap(summaries_);
+    }
+    for (auto& m : taken) {
+        m.timestamp = clock::now();
+        f(m);
+    }
+}
+
+inline auto throttle::rate_limited(msg const& m, std::int64_t now) -> bool
+{
+    auto const interval = emission_interval_.load(std::memory_order_relaxed);
+    if (interval <= 0)
+        return false;
+
+    auto const tolerance = burst_tolerance_.load(std::memory_order_relaxed);
+    auto const per_message =
+        rate_scope_.load(std::memory_order_relaxed) == throttle_scope::message;
+    auto& tat = tat_[hash(m, per_message) % table_size];
+
+    auto t = tat.load(std::memory_order_relaxed);
+    while (true) {
+        auto const start = std::max(t, now);
+        if (start - now > tolerance)
+            return true;
+        if (tat.compare_exchange_weak(
+                t, start + interval, std::memory_order_relaxed))
+            return false;
+    }
+}
+
+} // namespace zappy
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <mutex>
 #include <thread>
@@ -8,6 +10,7 @@ namespace zappy::details {
 struct worker {
 private:
     bool active;
+    bool wake_ = false;
     std::thread t;
     std::mutex mux;
     std::condition_variable cv;
@@ -20,17 +23,33 @@ public:
         if (!active)
             return;
         t = std::thread([this, callback, interval]() {
+            auto lock = std::unique_lock(this->mux);
             while (true) {
-                auto lock = std::unique_lock(this->mux);
-                if (this->cv.wait_for(
-                        lock, interval, [this] { return !this->active; })) {
+                this->cv.wait_for(lock, interval,
+                    [this] { return !this->active || this->wake_; });
+                if (!this->active)
                     return;
-                }
+                this->wake_ = false;
+
+                // the callback runs unlocked so that wake() never blocks
+                lock.unlock();
                 callback();
+                lock.lock();
             }
         });
     }
 
+    // runs the callback as soon as possible instead of waiting for the next
+    // interval
+    void wake()
+    {
+        {
+            auto _ = std::lock_guard{mux};
+            wake_ = true;
+        }
+        cv.notify_one();
+    }
+
     ~worker()
     {
         if (t.joinable()) {
@@ -1,24 +1,43 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string_view>
 #include <vector>
 
 #include <zappy/details/common.hpp>
 #include <zappy/details/core.hpp>
+#include <zappy/details/fmt.hpp>
+#include <zappy/details/record-codec.hpp>
+#include <zappy/details/scope.hpp>
+#include <zappy/details/span.hpp>
 
 namespace zappy {
 
+struct log_span;
+
 struct logger {
 private:
     std::string name_;
     std::shared_ptr<core> core_;
-    std::vector<attribute> attributes_;
+    std::uint32_t id_ = 0; // in the routing table of core_
+    std::shared_ptr<details::attr_context const> context_;
+
+    // asks for a background flush or sync after a record of level l
+    static void wake_worker(level l)
+    {
+        if (core::auto_sync && core::auto_sync(l))
+            core::request_sync();
+        else if (core::auto_flush && core::auto_flush(l))
+            core::request_flush();
+    }
 
 public:
     level_filter levels;
 
-    using attr_init_list = std::initializer_list<attribute>;
+    using attr_init_list = std::initializer_list<attribute_view>;
 
     logger(std::string_view name, std::shared_ptr<core> c);
     logger(logger const&) = default;
@@ -31,49 +50,149 @@ public:
 
     auto should_log(level v) const -> bool;
 
+    // holds back the records logged on this thread into the core of this
+    // logger until the scope is committed or a trigger record arrives, see
+    // log_scope
+    auto scope(level_filter&& trigger = zappy::levels(
+                   level::error, level::critical)) const -> log_scope
+    {
+        return log_scope{core_, std::move(trigger)};
+    }
+
+    // times the code until the returned span ends, see log_span
+    auto span(std::string_view name, attr_init_list aa = {},
+        zappy::level l = level::info) const -> log_span;
+
     void log(msg&& m) const;
 
     void log(
-        zappy::level l, std::string const& m, attr_init_list aa = {}) const;
+        zappy::level l, std::string_view m, attr_init_list aa = {}) const;
 
-    void debug(std::string const& m, attr_init_list aa = {}) const
+    void debug(std::string_view m, attr_init_list aa = {}) const
     {
         log(level::debug, m, aa);
     }
-    void info(std::string const& m, attr_init_list aa = {}) const
+    void info(std::string_view m, attr_init_list aa = {}) const
     {
         log(level::info, m, aa);
     }
-    void warn(std::string const& m, attr_init_list aa = {}) const
+    void warn(std::string_view m, attr_init_list aa = {}) const
     {
         log(level::warn, m, aa);
     }
-    void error(std::string const& m, attr_init_list aa = {}) const
+    void error(std::string_view m, attr_init_list aa = {}) const
     {
         log(level::error, m, aa);
     }
-    void critical(std::string const& m, attr_init_list aa = {}) const
+    void critical(std::string_view m, attr_init_list aa = {}) const
     {
         log(level::critical, m, aa);
     }
 };
 
+// log_span logs one record when it ends, named after the span, with the
+// attributes given to it and the time it was open in nanoseconds:
+//
+//   {
+//       auto s = lg.span("db.query", {{"table", "users"}});
+//       ...
+//   } // "db.query" table=users duration_ns=48211 span_id=... thread=1
+//
+// Spans opened on a thread while another one is open get its id as their
+// parent_id. A span the logger would not log is inert: it reads no clock and
+// builds no record. Spans must end on the thread that opened them, in the
+// reverse order, and not outlive their logger
+struct log_span {
+private:
+    logger const* logger_ = nullptr;
+    std::optional<msg> record_; // empty for inert spans
+    std::chrono::steady_clock::time_point start_;
+    std::uint64_t id_ = 0;
+    std::uint64_t parent_ = 0;
+
+public:
+    // user-provided, so that inert spans are not zeroed
+    log_span() {}
+    log_span(logger const& lg, level l, std::string_view name,
+        logger::attr_init_list aa)
+        : logger_{&lg}
+        , record_{std::in_place, l, name, aa}
+    {
+        auto& ids = details::span_ids::get();
+        id_ = ids.next();
+        parent_ = ids.current;
+        ids.current = id_;
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    log_span(log_span const&) = delete;
+    auto operator=(log_span const&) -> log_span& = delete;
+
+    ~log_span() { end(); }
+
+    auto active() const -> bool { return record_.has_value(); }
+    auto id() const -> std::uint64_t { return id_; }
+
+    // logs the span now instead of at the end of the scope
+    void end()
+    {
+        if (!record_)
+            return;
+        auto const d = std::chrono::steady_clock::now() - start_;
+        auto& ids = details::span_ids::get();
+        ids.current = parent_;
+
+        auto& m = *record_;
+        m.timestamp = clock::now();
+        char buf[24];
+        m.add_attr(details::span_duration_key,
+            details::number_sv(buf, std::uint64_t(d.count())));
+        m.add_attr(details::span_id_key, details::number_sv(buf, id_));
+        if (parent_)
+            m.add_attr(
+                details::span_parent_key, details::number_sv(buf, parent_));
+        m.add_attr(
+            details::span_thread_key, details::number_sv(buf, ids.thread));
+        logger_->log(std::move(m));
+        record_.reset();
+    }
+};
+
+inline auto logger::span(std::string_view name, attr_init_list aa,
+    zappy::level l) const -> log_span
+{
+    if (!should_log(l))
+        return {};
+    return {*this, l, name, aa};
+}
+
 inline logger::logger(std::string_view name, std::shared_ptr<core> c)
     : name_{name}
     , core_{c}
+    , id_{c ? c->intern(name) : 0}
 {
 }
 
 inline auto logger::with_attributes(attr_init_list attrs) -> logger
 {
+    // rendered once here, shared by every record of the returned logger
+    auto ctx = std::make_shared<details::attr_context>();
+    if (context_)
+        ctx->attributes = context_->attributes;
+    for (auto const& a : attrs)
+        ctx->attributes.push_back(a);
+    details::render_context(*ctx);
+
     auto ret = logger{*this};
-    ret.attributes_.insert(ret.attributes_.end(), attrs.begin(), attrs.end());
+    ret.context_ = std::move(ctx);
     return ret;
 }
 
 inline auto logger::should_log(level v) const -> bool
 {
-    return core_ && (!levels || levels(v));
+    // rejects records no sink takes before they are built; records that
+    // filters have to look at are built
+    return core_ && levels(v) && bool(core_->route(id_, v));
 }
 
 inline void logger::log(msg&& m) const
@@ -83,22 +202,42 @@ inline void logger::log(msg&& m) const
         return;
 
     m.logger_name = name_;
-    if (!attributes_.empty())
-        m.attributes.insert(
-            m.attributes.end(), attributes_.begin(), attributes_.end());
-
-    core_->write(std::move(m));
+    if (context_ && !m.context)
+        m.context = context_;
+    else if (context_)
+        for (auto a : context_->attributes)
+            m.attributes.push_back(a);
+
+    if (log_scope::capture(*core_, id_, l, [&](std::string& out) {
+            details::encode_record(out, m);
+        }))
+        return;
 
-    if (core::auto_flush && core::auto_flush(l))
-        core::flush();
+    if (core_->write(std::move(m), id_))
+        wake_worker(l);
 }
 
 inline void logger::log(
-    zappy::level l, std::string const& m, attr_init_list aa) const
+    zappy::level l, std::string_view m, attr_init_list aa) const
 {
     if (!should_log(l))
         return;
-    log(msg{l, m, aa});
+    if (log_scope::capture(*core_, id_, l, [&](std::string& out) {
+            auto const n = aa.size() +
+                           (context_ ? context_->attributes.size() : 0);
+            details::encode_record(out, clock::now(), l, name_, m, n,
+                [&](auto&& f) {
+                    for (auto a : aa)
+                        f(a);
+                    if (context_)
+                        for (auto a : context_->attributes)
+                            f(a);
+                });
+        }))
+        return;
+    if (core_->write(l, name_, m, std::span(aa.begin(), aa.size()), context_,
+            id_))
+        wake_worker(l);
 }
 
 } // namespace zappy
\ No newline at end of file
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <zappy/details/common.hpp>
+#include <zappy/details/json-scrambler.hpp>
+#include <zappy/details/line-scan.hpp>
+#include <zappy/details/mapped-file.hpp>
+#include <zappy/details/rotating-file.hpp>
+#include <zappy/details/stringers.hpp>
+
+namespace zappy {
+
+// read_filter selects records from jsonl or text log files
+//
+// timestamps are compared in their rendered form, so since/until may be full
+// timestamps or any prefix of one (e.g. "2024-05-01T10")
+struct read_filter {
+    level_filter levels;
+    std::vector<std::string> loggers;      // exact logger names, any of
+    std::string since;                     // inclusive lower bound
+    std::string until;                     // exclusive upper bound
+    std::vector<attribute> attributes;     // key=value pairs, all of
+
+    void set_since(clock::time_point t) { since = to_string(t); }
+    void set_until(clock::time_point t) { until = to_string(t); }
+};
+
+// a matching line, views into the segment mapped by the log_reader
+struct log_line {
+    std::string_view timestamp;
+    std::string_view text;
+};
+
+// returns the segments of a rotating log, oldest first: name.N.ext, ...,
+// name.1.ext, name.ext
+inline auto rotated_segments(std::filesystem::path const& fn)
+    -> std::vector<std::filesystem::path>
+{
+    auto base = std::string{};
+    auto ext = std::string{};
+    details::decompose_fn(fn.filename().string(), base, ext);
+
+    auto numbered = std::vector<std::pair<std::size_t, std::filesystem::path>>{};
+    auto dir = fn.parent_path();
+    auto ec = std::error_code{};
+    for (auto it = std::filesystem::directory_iterator(
+             dir.empty() ? std::filesystem::path(".") : dir, ec);
+         !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        auto const name = it->path().filename().string();
+        if (name.size() <= base.size() + ext.size() + 1 ||
+            !name.starts_with(base) || !name.ends_with(ext) ||
+            name[base.size()] != '.')
+            continue;
+        auto const digits = std::string_view(name).substr(
+            base.size() + 1, name.size() - base.size() - ext.size() - 1);
+        auto n = std::size_t{0};
+        auto [p, err] =
+            std::from_chars(digits.data(), digits.data() + digits.size(), n);
+        if (err != std::errc{} || p != digits.data() + digits.size() || !n)
+            continue;
+        numbered.emplace_back(n, dir / name);
+    }
+
+    std::sort(numbered.begin(), numbered.end(),
+        [](auto const& a, auto const& b) { return a.first > b.first; });
+
+    auto ret = std::vector<std::filesystem::path>{};
+    for (auto& [_, p] : numbered)
+        ret.push_back(std::move(p));
+    if (std::filesystem::exists(fn, ec))
+        ret.push_back(fn);
+    return ret;
+}
+
+namespace details {
+
+// line_matcher evaluates a read_filter against a single line, extracting only
+// the fields the filter refers to, and without unescaping any values
+struct line_matcher {
+    read_filter const& flt;
+    std::vector<std::pair<std::string, std::string>> attrs; // pre-escaped
+
+    explicit line_matcher(read_filter const& f)
+        : flt{f}
+    {
+        auto scrambled = [](std::string_view s) {
+            auto ret = std::string{};
+            json_scramble([&](std::string_view sv) { ret += sv; }, s);
+            return ret;
+        };
+        for (auto const& a : f.attributes)
+            attrs.emplace_back(scrambled(a.key), scrambled(a.value));
+    }
+
+    auto check_timestamp(std::string_view ts) const -> bool
+    {
+        if (!flt.since.empty() && ts.substr(0, flt.since.size()) < flt.since)
+            return false;
+        if (!flt.until.empty() && ts.substr(0, flt.until.size()) >= flt.until)
+            return false;
+        return true;
+    }
+
+    auto check_logger(std::string_view name) const -> bool
+    {
+        return flt.loggers.empty() ||
+               std::find(flt.loggers.begin(), flt.loggers.end(), name) !=
+                   flt.loggers.end();
+    }
+
+    auto check_level(std::string_view name) const -> bool
+    {
+        if (flt.levels.all())
+            return true;
+        auto v = level::info;
+        return from_sv(name, v) && flt.levels(v);
+    }
+
+    auto match_attr(std::string_view k, std::string_view v,
+        std::uint64_t& matched) const -> void
+    {
+        for (std::size_t i = 0; i < attrs.size() && i < 64; ++i)
+            if (attrs[i].first == k && attrs[i].second == v)
+                matched |= std::uint64_t{1} << i;
+    }
+
+    auto all_attrs(std::uint64_t matched) const -> bool
+    {
+        auto const n = std::min<std::size_t>(attrs.size(), 64);
+        return n == 64 ? matched == ~std::uint64_t{0}
+                       : matched == (std::uint64_t{1} << n) - 1;
+    }
+
+    // json lines as produced by to_json: a flat object of string values
+    auto match_json(std::string_view line, std::string_view& ts) const -> bool
+    {
+        auto p = line.data() + 1;
+        auto const end = line.data() + line.size();
+        auto seen_logger = false;
+        auto matched = std::uint64_t{0};
+
+        while (p < end && *p == '"') {
+            auto const key_begin = p + 1;
+            auto const key_end = find_string_end(key_begin, end);
+            if (key_end == end || key_end + 2 >= end || key_end[1] != ':' ||
+                key_end[2] != '"')
+                return false;
+            auto const val_begin = key_end + 3;
+            auto const val_end = find_string_end(val_begin, end);
+            if (val_end == end)
+                return false;
+            p = val_end + 1;
+            if (p < end && *p == ',')
+                ++p;
+
+            auto const key = std::string_view(
+                key_begin, std::size_t(key_end - key_begin));
+            auto const val = std::string_view(
+                val_begin, std::size_t(val_end - val_begin));
+
+            if (key == "timestamp") {
+                ts = val;
+                if (!check_timestamp(val))
+                    return false;
+            }
+            else if (key == "logger") {
+                seen_logger = true;
+                if (!check_logger(val))
+                    return false;
+            }
+            else if (key == "level") {
+                if (!check_level(val))
+                    return false;
+            }
+            else if (key == "message") {
+                // to_json writes all builtin fields ahead of the message
+                if (attrs.empty())
+                    break;
+            }
+            else if (!attrs.empty()) {
+                match_attr(key, val, matched);
+            }
+        }
+        return (seen_logger || check_logger({})) && all_attrs(matched);
+    }
+
+    // text lines as produced by to_text:
+    // "<timestamp> [logger] [level] message | key=value | ..."
+    auto match_text(std::string_view line, std::string_view& ts) const -> bool
+    {
+        static constexpr std::size_t ts_len = 27;
+        if (line.size() < ts_len)
+            return false;
+        ts = line.substr(0, ts_len);
+        if (!check_timestamp(ts))
+            return false;
+
+        auto rest = line.substr(ts_len);
+        auto bracketed = [&rest](std::string_view& out) -> bool {
+            if (!rest.starts_with(" ["))
+                return false;
+            auto const close = rest.find(']', 2);
+            if (close == std::string_view::npos)
+                return false;
+            out = rest.substr(2, close - 2);
+            rest.remove_prefix(close + 1);
+            return true;
+        };
+
+        // the logger is left out for records without one: the first token
+        // is the logger if a level follows it, which also holds for loggers
+        // named like a level, and the level otherwise. Error and critical
+        // records without a logger whose message starts with a bracketed
+        // level read the same as records of a logger named like their level
+        auto first = std::string_view{};
+        if (!bracketed(first))
+            return false;
+        auto const after_first = rest;
+        auto logger_name = std::string_view{};
+        auto level_name = std::string_view{};
+        auto v = level::info;
+        if (bracketed(level_name) && from_sv(level_name, v))
+            logger_name = first;
+        else if (from_sv(first, v)) {
+            level_name = first;
+            rest = after_first;
+        }
+        else
+            return false;
+        if (!check_logger(logger_name) || !check_level(level_name))
+            return false;
+        if (attrs.empty())
+            return true;
+
+        auto matched = std::uint64_t{0};
+        static constexpr auto sep = std::string_view(" | ");
+        for (auto pos = rest.find(sep); pos != std::string_view::npos;
+             pos = rest.find(sep)) {
+            rest.remove_prefix(pos + sep.size());
+            auto const item = rest.substr(0, rest.find(sep));
+            auto const eq = item.find('=');
+            if (eq != std::string_view::npos)
+                match_attr(item.substr(0, eq), item.substr(eq + 1), matched);
+        }
+        return all_attrs(matched);
+    }
+
+    auto match(std::string_view line, std::string_view& ts) const -> bool
+    {
+        ts = {};
+        return line.front() == '{' ? match_json(line, ts)
+                                   : match_text(line, ts);
+    }
+};
+
+} // namespace details
+
+// log_reader maps a set of log segments and searches them in parallel
+struct log_reader {
+private:
+    std::vector<std::filesystem::path> segments_;
+    std::vector<details::mapped_file> maps_;
+
+public:
+    // opens every rotated sibling of each of the given log files
+    explicit log_reader(std::vector<std::filesystem::path> const& files);
+    explicit log_reader(std::filesystem::path const& file)
+        : log_reader(std::vector<std::filesystem::path>{file})
+    {
+    }
+
+    auto segments() const -> std::vector<std::filesystem::path> const&
+    {
+        return segments_;
+    }
+
+    // returns matching lines ordered by timestamp; lines stay valid for the
+    // lifetime of the reader
+    auto find(read_filter const& flt, unsigned threads = 0) const
+        -> std::vector<log_line>;
+};
+
+inline log_reader::log_reader(std::vector<std::filesystem::path> const& files)
+{
+    for (auto const& fn : files)
+        for (auto& seg : rotated_segments(fn)) {
+            auto m = details::mapped_file{seg};
+            if (!m.is_open())
+                continue;
+            segments_.push_back(std::move(seg));
+            maps_.push_back(std::move(m));
+        }
+}
+
+inline auto log_reader::find(read_filter const& flt, unsigned threads) const
+    -> std::vector<log_line>
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // split segments into newline-aligned chunks so that a single large file
+    // is still searched by all threads
+    static constexpr std::size_t min_chunk = 1 << 20;
+    auto chunks = std::vector<std::string_view>{};
+    for (auto const& m : maps_) {
+        auto text = m.view();
+        auto const target = std::max(min_chunk, text.size() / threads + 1);
+        while (!text.empty()) {
+            auto n = std::min(target, text.size());
+            auto const tail = text.data() + n;
+            auto const eol =
+                details::find_char(tail, text.data() + text.size(), '\n');
+            n = std::min(text.size(), std::size_t(eol - text.data()) + 1);
+            chunks.push_back(text.substr(0, n));
+            text.remove_prefix(n);
+        }
+    }
+
+    auto const matcher = details::line_matcher{flt};
+    auto results = std::vector<std::vector<log_line>>(chunks.size());
+    auto next = std::atomic<std::size_t>{0};
+    auto work = [&] {
+        for (auto i = next++; i < chunks.size(); i = next++) {
+            auto& out = results[i];
+            details::for_each_line(chunks[i], [&](std::string_view line) {
+                auto ts = std::string_view{};
+                if (matcher.match(line, ts))
+                    out.push_back({ts, line});
+            });
+        }
+    };
+
+    auto pool = std::vector<std::thread>{};
+    auto const n_threads = std::min<std::size_t>(threads, chunks.size());
+    for (std::size_t i = 1; i < n_threads; ++i)
+        pool.emplace_back(work);
+    work();
+    for (auto& t : pool)
+        t.join();
+
+    // chunks are concatenated oldest first, so a stable sort keeps equal
+    // timestamps in file order
+    auto ret = std::vector<log_line>{};
+    for (auto& r : results)
+        ret.insert(ret.end(), r.begin(), r.end());
+    std::stable_sort(ret.begin(), ret.end(),
+        [](log_line const& a, log_line const& b) {
+            return a.timestamp < b.timestamp;
+        });
+    return ret;
+}
+
+} // namespace zappy
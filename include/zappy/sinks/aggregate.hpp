@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <zappy/details/common.hpp>
+
+namespace zappy {
+
+struct aggregate_policy {
+    std::chrono::milliseconds interval = std::chrono::seconds{10};
+    // records are grouped by the fields chosen here and by the values of
+    // the attributes in keys
+    bool by_logger = true;
+    bool by_level = true;
+    bool by_message = true;
+    std::vector<std::string> keys;
+    // numeric attributes summarized with a histogram per group
+    std::vector<std::string> values;
+    // records of further groups are counted as dropped
+    std::size_t max_groups = 10000;
+};
+
+namespace details {
+
+// log_linear_histogram counts non-negative values into buckets of 16 per
+// power of two, for a relative error of 1/32 at most. The bucket of a value
+// is the exponent and the upper mantissa bits of its double representation;
+// values below 2^-16 fall into the first bucket, values from 2^48 up into
+// the last
+struct log_linear_histogram {
+    static constexpr int sub_bits = 4;
+    static constexpr int min_exp = -16;
+    static constexpr int max_exp = 48;
+    static constexpr std::size_t bucket_count =
+        std::size_t(max_exp - min_exp) << sub_bits;
+
+    std::vector<std::uint32_t> buckets; // allocated by the first add
+    std::uint64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    static auto bucket_of(double v) -> std::size_t
+    {
+        static constexpr auto first =
+            std::uint64_t(1023 + min_exp) << sub_bits;
+        auto const key = std::bit_cast<std::uint64_t>(v) >> (52 - sub_bits);
+        if (!(v > 0) || key < first)
+            return 0;
+        return std::min<std::size_t>(key - first, bucket_count - 1);
+    }
+
+    // middle of bucket i
+    static auto value_of(std::size_t i) -> double
+    {
+        auto const key = (std::uint64_t(1023 + min_exp) << sub_bits) + i;
+        return std::bit_cast<double>(
+            key << (52 - sub_bits) | std::uint64_t{1} << (51 - sub_bits));
+    }
+
+    void add(double v)
+    {
+        if (buckets.empty())
+            buckets.resize(bucket_count);
+        ++buckets[bucket_of(v)];
+        ++count;
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+    }
+
+    // the q-th quantile, q in [0, 1], within the error of its bucket
+    auto percentile(double q) const -> double
+    {
+        if (!count)
+            return 0;
+        auto const rank = std::uint64_t(q * double(count - 1)) + 1;
+        auto seen = std::uint64_t{0};
+        for (std::size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::clamp(value_of(i), min, max);
+        }
+        return max;
+    }
+
+    void clear()
+    {
+        std::fill(buckets.begin(), buckets.end(), 0);
+        count = 0;
+        sum = 0;
+        min = std::numeric_limits<double>::infinity();
+        max = -std::numeric_limits<double>::infinity();
+    }
+};
+
+// aggregate_sink_impl counts the records it takes by group and writes one
+// summary record per group and interval into the target sink, from flush
+struct aggregate_sink_impl : public sink {
+    struct group {
+        std::string logger_name;
+        zappy::level level = zappy::level::info;
+        std::string message;
+        std::vector<std::string> keys; // values of the key attributes
+        std::uint64_t count = 0;
+        std::vector<log_linear_histogram> values;
+    };
+
+    struct key_hash {
+        using is_transparent = void;
+        auto operator()(std::string_view sv) const -> std::size_t
+        {
+            return std::hash<std::string_view>{}(sv);
+        }
+    };
+
+    sink_ptr target;
+    aggregate_policy pol;
+    std::chrono::steady_clock::time_point next_report;
+    std::mutex mux; // guards everything below
+    std::unordered_map<std::string, group, key_hash, std::equal_to<>> groups;
+    // per record: the values of the key and value attributes, and the key of
+    // its group, reused
+    std::vector<std::string_view> key_values;
+    std::vector<std::string_view> value_values;
+    std::string scratch;
+
+    aggregate_sink_impl(
+        sink_ptr t, aggregate_policy const& p, level_filter&& flt)
+        : sink{std::move(flt)}
+        , target{std::move(t)}
+        , pol{p}
+        , next_report{std::chrono::steady_clock::now() + p.interval}
+        , key_values(p.keys.size())
+        , value_values(p.values.size())
+    {
+    }
+
+    // the last partial interval; the core may have flushed the target for
+    // the last time already
+    ~aggregate_sink_impl()
+    {
+        report();
+        if (target)
+            flush_sink(*target);
+    }
+
+    // appends sv prefixed by its size, so that keys do not run together
+    static void put(std::string& out, std::string_view sv)
+    {
+        auto const n = std::uint32_t(sv.size());
+        char buf[sizeof(n)];
+        std::memcpy(buf, &n, sizeof(n));
+        out.append(buf, sizeof(n));
+        out += sv;
+    }
+
+    void write(msg const& m) override
+    {
+        auto _ = std::unique_lock(mux);
+        for (auto& v : key_values)
+            v = {};
+        for (auto& v : value_values)
+            v = {};
+        m.for_each_attr([&](attribute_view a) {
+            for (std::size_t i = 0; i < pol.keys.size(); ++i)
+                if (a.key == pol.keys[i])
+                    key_values[i] = a.value;
+            for (std::size_t i = 0; i < pol.values.size(); ++i)
+                if (a.key == pol.values[i])
+                    value_values[i] = a.value;
+        });
+
+        scratch.clear();
+        if (pol.by_logger)
+            put(scratch, m.logger_name);
+        if (pol.by_level)
+            scratch += char(m.level);
+        if (pol.by_message)
+            put(scratch, m.message);
+        for (auto v : key_values)
+            put(scratch, v);
+
+        auto it = groups.find(std::string_view(scratch));
+        if (it == groups.end()) {
+            if (groups.size() >= pol.max_groups) {
+                counters.dropped.add();
+                return;
+            }
+            auto g = group{};
+            if (pol.by_logger)
+                g.logger_name = m.logger_name;
+            if (pol.by_level)
+                g.level = m.level;
+            if (pol.by_message)
+                g.message = m.message;
+            g.keys.assign(key_values.begin(), key_values.end());
+            g.values.resize(pol.values.size());
+            it = groups.emplace(scratch, std::move(g)).first;
+        }
+
+        auto& g = it->second;
+        ++g.count;
+        for (std::size_t i = 0; i < value_values.size(); ++i) {
+            auto const v = value_values[i];
+            auto d = 0.0;
+            if (!v.empty() &&
+                std::from_chars(v.data(), v.data() + v.size(), d).ec ==
+                    std::errc{})
+                g.values[i].add(d);
+        }
+    }
+
+    void flush() override
+    {
+        auto _ = std::unique_lock(mux);
+        auto const now = std::chrono::steady_clock::now();
+        if (now < next_report)
+            return;
+        next_report = now + pol.interval;
+        report();
+        if (target)
+            flush_sink(*target);
+    }
+
+    // writes a summary record for every group that took records since the
+    // last report into the target, as the core would, and forgets the groups
+    // that did not
+    void report()
+    {
+        auto num = [](auto v) {
+            char buf[32];
+            auto const r = std::to_chars(buf, buf + sizeof(buf), v);
+            return std::string(buf, r.ptr);
+        };
+        auto const interval_ms = num(pol.interval.count());
+
+        std::erase_if(groups, [](auto const& it) { return !it.second.count; });
+        for (auto& [_, g] : groups) {
+            auto m = msg{g.level, pol.by_message ? g.message : "aggregate"};
+            m.logger_name = pol.by_logger ? g.logger_name : "zappy.aggregate";
+            for (std::size_t i = 0; i < g.keys.size(); ++i)
+                m.add_attr(pol.keys[i], g.keys[i]);
+            m.add_attr("count", num(g.count));
+            m.add_attr("interval_ms", interval_ms);
+            for (std::size_t i = 0; i < g.values.size(); ++i) {
+                auto& h = g.values[i];
+                if (!h.count)
+                    continue;
+                auto const& k = pol.values[i];
+                m.add_attr(k + ".count", num(h.count));
+                m.add_attr(k + ".sum", num(h.sum));
+                m.add_attr(k + ".min", num(h.min));
+                m.add_attr(k + ".max", num(h.max));
+                m.add_attr(k + ".p50", num(h.percentile(0.5)));
+                m.add_attr(k + ".p90", num(h.percentile(0.9)));
+                m.add_attr(k + ".p99", num(h.percentile(0.99)));
+                h.clear();
+            }
+            g.count = 0;
+            if (target && target->accepts(m))
+                deliver(*target, m);
+        }
+    }
+};
+
+} // namespace details
+
+// aggregate_sink summarizes the records it takes instead of writing them:
+// every interval it writes one record per group of records, with their
+// count and the count, sum, min, max and percentiles of the numeric
+// attributes in pol.values, into the target sink
+inline auto aggregate_sink(sink_ptr target, aggregate_policy const& pol = {},
+    level_filter&& flt = {}) -> sink_ptr
+{
+    return std::make_shared<details::aggregate_sink_impl>(
+        std::move(target), pol, std::move(flt));
+}
+
+} // namespace zappy
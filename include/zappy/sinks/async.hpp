@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <zappy/details/common.hpp>
+#include <zappy/details/queue.hpp>
+
+namespace zappy {
+
+enum class overflow_policy {
+    block,       // wait for space, backpressuring the core
+    drop_newest, // discard the record being written
+    drop_oldest, // discard the oldest buffered record
+};
+
+struct async_sink_policy {
+    std::size_t capacity = 1024;
+    zappy::overflow_policy overflow = overflow_policy::drop_newest;
+};
+
+namespace details {
+
+// async_sink_impl decouples a sink from the core worker: records are copied
+// into a bounded buffer and written into the inner sink by a dedicated
+// thread, so a slow or stuck inner sink only loses its own records
+struct async_sink_impl : public sink {
+    sink_ptr inner;
+    overflow_policy overflow;
+    queue<msg> buffer;
+    std::atomic<bool> flush_pending{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<std::uint64_t> popped{0}; // records taken out of buffer
+    // sync tickets; a request is served once the records buffered when it
+    // was made, up to its target count of popped records, are written
+    std::mutex sync_mux;
+    std::condition_variable sync_cv;
+    std::uint64_t sync_requested = 0;
+    std::uint64_t sync_completed = 0;
+    std::deque<std::pair<std::uint64_t, std::uint64_t>> syncs; // ticket, target
+    std::thread t;
+
+    async_sink_impl(sink_ptr s, async_sink_policy const& pol)
+        : sink{[s = s.get()](level v) { return s->should_log(v); }}
+        , inner{std::move(s)}
+        , overflow{pol.overflow}
+        , buffer{pol.capacity + 1}
+    {
+        t = std::thread([this] { run(); });
+    }
+
+    ~async_sink_impl()
+    {
+        stopping = true;
+        t.join();
+    }
+
+    void run()
+    {
+        // flush and sync requests are served when the buffer runs empty, and
+        // at the latest after serve_every records or idle_wait, so that
+        // producers keeping it busy do not starve them
+        static constexpr auto idle_wait = std::chrono::milliseconds{20};
+        static constexpr std::size_t serve_every = 256;
+        msg m;
+        auto since = std::size_t{0};
+        auto served = std::chrono::steady_clock::now();
+        while (true) {
+            auto const got = buffer.try_pop(m, idle_wait);
+            if (got && inner->filter.matches(m))
+                deliver(*inner, m);
+            if (got)
+                popped.fetch_add(1, std::memory_order_release);
+            if (got && !buffer.empty() && ++since < serve_every &&
+                std::chrono::steady_clock::now() - served < idle_wait)
+                continue;
+            since = 0;
+            served = std::chrono::steady_clock::now();
+            if (flush_pending.exchange(false))
+                flush_sink(*inner);
+            serve_syncs(buffer.empty());
+            if (!got && stopping)
+                break;
+        }
+        flush_sink(*inner);
+        serve_syncs(true);
+    }
+
+    // syncs the inner sink for the requests whose records are written, or
+    // for all of them, and wakes their waiters
+    void serve_syncs(bool all)
+    {
+        auto lock = std::unique_lock(sync_mux);
+        auto const done = popped.load(std::memory_order_acquire);
+        auto n = std::size_t{0};
+        for (std::size_t i = 0; i < syncs.size(); ++i)
+            if (all || syncs[i].second <= done)
+                n = i + 1;
+        if (!n)
+            return;
+        auto const ticket = syncs[n - 1].first;
+        syncs.erase(syncs.begin(), syncs.begin() + std::ptrdiff_t(n));
+        lock.unlock();
+
+        flush_sink(*inner);
+        inner->sync();
+        lock.lock();
+        sync_completed = ticket;
+        sync_cv.notify_all();
+    }
+
+    void write(msg const& m) override
+    {
+        switch (overflow) {
+        case overflow_policy::block:
+            buffer.push(m);
+            break;
+        case overflow_policy::drop_newest:
+            if (!buffer.try_push(msg{m}))
+                counters.dropped.add();
+            break;
+        case overflow_policy::drop_oldest:
+            if (!buffer.push_overwrite(msg{m}))
+                counters.dropped.add();
+            break;
+        }
+    }
+
+    // the inner sink is flushed and synced by the sink thread, see run;
+    // core::sync waits for it through wait_synced
+    void flush() override { flush_pending = true; }
+    void sync() override
+    {
+        // size before popped, so that the target is never short
+        auto const ahead = buffer.size();
+        auto const target = popped.load(std::memory_order_acquire) + ahead;
+        auto _ = std::unique_lock(sync_mux);
+        syncs.emplace_back(++sync_requested, target);
+    }
+    auto wait_synced(std::chrono::steady_clock::time_point deadline)
+        -> bool override
+    {
+        auto lock = std::unique_lock(sync_mux);
+        auto const ticket = sync_requested;
+        return sync_cv.wait_until(
+            lock, deadline, [&] { return sync_completed >= ticket; });
+    }
+
+    void attach(core& c) override { inner->attach(c); }
+    void detach(core& c) override { inner->detach(c); }
+};
+
+} // namespace details
+
+// async_sink runs the inner sink on its own thread with its own bounded
+// buffer and overflow policy
+inline auto async_sink(sink_ptr inner, async_sink_policy const& pol = {})
+    -> sink_ptr
+{
+    return std::make_shared<details::async_sink_impl>(std::move(inner), pol);
+}
+
+} // namespace zappy
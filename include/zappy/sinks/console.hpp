@@ -1,7 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <mutex>
 #include <zappy/details/common.hpp>
+#include <zappy/details/fd-writer.hpp>
 #include <zappy/details/fmt.hpp>
+#include <zappy/details/pattern.hpp>
 #include <zappy/details/terminal.hpp>
 
 namespace zappy {
@@ -35,6 +39,7 @@ struct console_sink_impl : public sink {
         static auto global_mux = std::mutex{};
         auto _ = std::unique_lock(global_mux);
         out.write(scratch.data(), scratch.size());
+        counters.bytes.add(scratch.size());
     }
 
     void flush() override {
@@ -44,6 +49,84 @@ struct console_sink_impl : public sink {
 
 } // namespace details
 
+enum class console_format {
+    ansi, // human readable, colored when writing to a color terminal
+    json, // json lines, as produced by to_json
+    pattern, // console_policy::pattern, colored like ansi
+};
+
+struct console_policy {
+    console_format format = console_format::ansi;
+    std::size_t buffer_size = 64 * 1024; // written out when exceeded
+    std::size_t max_buffer_size = 4 * 1024 * 1024; // discarded when exceeded
+    std::chrono::milliseconds write_timeout{100}; // for non-blocking pipes
+    std::string pattern{pattern_fmt::default_pattern}; // see pattern_fmt
+};
+
+namespace details {
+
+// fd_console_sink_impl writes into a file descriptor directly, bypassing
+// iostreams; records are batched in the descriptor's channel and written
+// out with a single write(2) on flush, or when the buffer fills up
+struct fd_console_sink_impl : public sink {
+    std::shared_ptr<fd_channel> channel;
+    console_policy pol;
+    ansi_fmt fmt;
+    pattern_fmt pattern;
+    std::string scratch;
+
+    fd_console_sink_impl(int fd, console_policy const& p, level_filter&& f)
+        : sink{std::move(f)}
+        , channel{fd_channel::get(fd)}
+        , pol{p}
+        , fmt{is_terminal(fd) && is_color_terminal()}
+        , pattern{p.format == console_format::pattern
+                      ? pattern_fmt{p.pattern, fmt.use_ansi_sequences}
+                      : pattern_fmt{}}
+    {
+    }
+
+    ~fd_console_sink_impl() { flush(); }
+
+    void prepare_output(std::string& out, msg const& m)
+    {
+        if (pol.format == console_format::json)
+            to_json(out, m);
+        else if (pol.format == console_format::pattern)
+            pattern.format(out, m);
+        else
+            fmt.format(out, m);
+    }
+
+    void write(msg const& m) override
+    {
+        prepare_output(scratch, m);
+        scratch += '\n';
+        counters.bytes.add(scratch.size());
+
+        auto _ = std::unique_lock(channel->mux);
+        channel->buffer += scratch;
+        ++channel->pending_records;
+        if (channel->buffer.size() < pol.buffer_size)
+            return;
+        channel->drain(pol.write_timeout);
+        if (channel->buffer.size() > pol.max_buffer_size) {
+            // the reader is not keeping up, give up on the backlog
+            counters.dropped.add(channel->pending_records);
+            channel->buffer.clear();
+            channel->pending_records = 0;
+        }
+    }
+
+    void flush() override
+    {
+        auto _ = std::unique_lock(channel->mux);
+        channel->drain(pol.write_timeout);
+    }
+};
+
+} // namespace details
+
 inline auto stdout_sink(level_filter&& f) -> sink_ptr
 {
     static auto v =
@@ -58,4 +141,36 @@ inline auto stderr_sink(level_filter&& f) -> sink_ptr
     return v;
 }
 
+// stdout_fd_sink and stderr_fd_sink write into file descriptors 1 and 2
+// with their own buffering, suitable for high-volume container logs
+#ifdef _WIN32
+inline auto stdout_fd_sink(level_filter&& f = {}, console_policy const& pol = {})
+    -> sink_ptr
+{
+    return std::make_shared<details::fd_console_sink_impl>(
+        _fileno(stdout), pol, std::move(f));
+}
+
+inline auto stderr_fd_sink(level_filter&& f = {}, console_policy const& pol = {})
+    -> sink_ptr
+{
+    return std::make_shared<details::fd_console_sink_impl>(
+        _fileno(stderr), pol, std::move(f));
+}
+#else
+inline auto stdout_fd_sink(level_filter&& f = {}, console_policy const& pol = {})
+    -> sink_ptr
+{
+    return std::make_shared<details::fd_console_sink_impl>(
+        STDOUT_FILENO, pol, std::move(f));
+}
+
+inline auto stderr_fd_sink(level_filter&& f = {}, console_policy const& pol = {})
+    -> sink_ptr
+{
+    return std::make_shared<details::fd_console_sink_impl>(
+        STDERR_FILENO, pol, std::move(f));
+}
+#endif
+
 } // namespace zappy
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <zappy/details/common.hpp>
 #include <zappy/details/fmt.hpp>
+#include <zappy/details/pattern.hpp>
 #include <zappy/details/rotating-file.hpp>
 #include <variant>
 
@@ -12,27 +13,64 @@ namespace zappy {
 struct rotating_file_policy {
     std::size_t max_size = 1024 * 1024;
     std::size_t max_count = 5;
+    durability sync = durability::none;
+    std::chrono::milliseconds sync_interval{1000}; // durability::periodic
+    std::size_t sync_bytes = 0; // durability::periodic, 0 for none
+    // writes with O_DIRECT, around the page cache, into segments allocated
+    // up front; falls back to buffered writes where unsupported
+    bool direct_io = false;
+    // appends to a file other processes write to as well: records are
+    // written in whole O_APPEND writes and rotation is coordinated through
+    // a lock file; POSIX only, overrides direct_io
+    bool shared = false;
 };
 
 namespace details {
 
 struct json_fmt {};
 struct text_fmt {};
-using fmt = std::variant<json_fmt, text_fmt>;
+using fmt = std::variant<json_fmt, text_fmt, pattern_fmt>;
 
 struct rotating_file_sink_impl : public sink {
     details::rotating_file f;
     fmt formatter;
     std::mutex write_mux;
     std::string scratch;
+    std::size_t rotations = 0; // of f, accounted for in counters
+    std::size_t syncs = 0;
+    std::size_t dropped = 0;
 
     rotating_file_sink_impl(std::filesystem::path const& fn,
         fmt const& formatter, rotating_file_policy const& pol,
         level_filter&& flt)
         : sink{std::move(flt)}
-        , f{fn, details::rotating_file::policy{pol.max_size, pol.max_count}}
+        , f{fn,
+              details::rotating_file::policy{
+                  .max_size = pol.max_size,
+                  .max_count = pol.max_count,
+                  .sync = pol.sync,
+                  .sync_interval = pol.sync_interval,
+                  .sync_bytes = pol.sync_bytes,
+                  .direct_io = pol.direct_io,
+                  .shared = pol.shared,
+              }}
         , formatter{formatter}
     {
+        f.sync_latency = &counters.sync_latency;
+    }
+
+    // counts the rotations, syncs and drops of f since the last call
+    void account()
+    {
+        if (auto n = f.rotations() - rotations)
+            counters.rotations.add(n);
+        if (auto n = f.syncs() - syncs)
+            counters.syncs.add(n);
+        if (auto n = f.dropped() - dropped)
+            counters.dropped.add(n);
+        rotations = f.rotations();
+        syncs = f.syncs();
+        dropped = f.dropped();
     }
 
     void prepare_output(std::string& out, msg const& m)
@@ -41,6 +79,8 @@ struct rotating_file_sink_impl : public sink {
             to_json(out, m);
         else if (std::holds_alternative<text_fmt>(formatter))
             to_text(out, m);
+        else
+            std::get<pattern_fmt>(formatter).format(out, m);
     }
 
     void write(msg const& m) override
@@ -49,11 +89,22 @@ struct rotating_file_sink_impl : public sink {
         prepare_output(scratch, m);
         scratch += "\n";
         f.write(scratch);
+        counters.bytes.add(scratch.size());
+        account();
     }
 
-    void flush() {
+    void flush() override
+    {
         auto _ = std::unique_lock(write_mux);
         f.flush();
+        account();
+    }
+
+    void sync() override
+    {
+        auto _ = std::unique_lock(write_mux);
+        f.sync();
+        account();
     }
 };
 
@@ -85,4 +136,14 @@ inline auto rotating_text_file_sink(
     return rotating_text_file_sink(fn, rotating_file_policy{}, std::move(flt));
 }
 
+// rotating_pattern_file_sink writes records formatted after a pattern_fmt
+// pattern, without colors
+inline auto rotating_pattern_file_sink(std::filesystem::path const& fn,
+    std::string_view pattern, rotating_file_policy const& pol = {},
+    level_filter&& flt = {}) -> sink_ptr
+{
+    return std::make_shared<details::rotating_file_sink_impl>(
+        fn, pattern_fmt{pattern}, pol, std::move(flt));
+}
+
 } // namespace zappy
\ No newline at end of file
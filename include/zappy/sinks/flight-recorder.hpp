@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zappy/details/circular.hpp>
+#include <zappy/details/common.hpp>
+#include <zappy/details/record-codec.hpp>
+
+namespace zappy {
+
+struct flight_recorder_policy {
+    // history kept, whichever limit is reached first
+    std::size_t max_records = 4096;
+    std::size_t max_bytes = 1024 * 1024; // of encoded records
+    // records at or above this level dump the history, none of them dumps
+    // only on request
+    level_filter trigger = levels(level::error, level::critical);
+    bool flush_target = true; // flushes the target after every dump
+};
+
+// flight_recorder keeps the latest records in memory, encoded with
+// encode_record into a ring of reused buffers, and writes them to a target
+// sink only when a trigger record arrives or dump is called; recording does
+// no I/O, and no allocation once the buffers have grown to the usual record
+// size. Dumped records leave the history.
+//
+// The target should not be connected to a core as well, or it receives the
+// dumped records twice
+struct flight_recorder : public sink {
+private:
+    sink_ptr target_;
+    flight_recorder_policy pol_;
+    std::mutex mux_; // guards everything below
+    std::vector<std::string> slots_;
+    circular<std::string> ring_;
+    std::size_t bytes_ = 0; // in ring_
+    msg scratch_;
+
+    void dump_locked(sink& to)
+    {
+        while (!ring_.empty()) {
+            auto in = std::string_view(ring_.front());
+            bytes_ -= in.size();
+            if (details::decode_record(in, scratch_) && to.accepts(scratch_))
+                details::deliver(to, scratch_);
+            ring_.pop_front();
+        }
+        if (pol_.flush_target)
+            details::flush_sink(to);
+    }
+
+public:
+    flight_recorder(sink_ptr target, flight_recorder_policy const& pol,
+        level_filter&& flt)
+        : sink{std::move(flt)}
+        , target_{std::move(target)}
+        , pol_{pol}
+        // circular keeps one slot free
+        , slots_(std::max<std::size_t>(pol.max_records, 1) + 1)
+        , ring_{slots_}
+    {
+    }
+
+    void write(msg const& m) override
+    {
+        auto _ = std::unique_lock(mux_);
+        if (ring_.full()) {
+            bytes_ -= ring_.front().size();
+            ring_.pop_front();
+        }
+        auto& slot = ring_.next();
+        slot.clear();
+        details::encode_record(slot, m);
+        bytes_ += slot.size();
+        ring_.commit_back();
+        counters.bytes.add(slot.size());
+        while (bytes_ > pol_.max_bytes && ring_.size() > 1) {
+            bytes_ -= ring_.front().size();
+            ring_.pop_front();
+        }
+
+        if (pol_.trigger(m.level) && target_)
+            dump_locked(*target_);
+    }
+
+    // the history is only ever written by dump
+    void flush() override {}
+
+    // writes the history to the target sink, oldest record first
+    void dump()
+    {
+        auto _ = std::unique_lock(mux_);
+        if (target_)
+            dump_locked(*target_);
+    }
+
+    // writes the history to another sink
+    void dump(sink& to)
+    {
+        auto _ = std::unique_lock(mux_);
+        dump_locked(to);
+    }
+
+    // records and encoded bytes currently held
+    auto size() -> std::size_t
+    {
+        auto _ = std::unique_lock(mux_);
+        return ring_.size();
+    }
+    auto size_bytes() -> std::size_t
+    {
+        auto _ = std::unique_lock(mux_);
+        return bytes_;
+    }
+};
+
+// flight_recorder_sink records everything its level filter lets through,
+// typically debug and up, and hands it to target on trigger records or
+// on dump()
+inline auto flight_recorder_sink(sink_ptr target,
+    flight_recorder_policy const& pol = {}, level_filter&& flt = {})
+    -> std::shared_ptr<flight_recorder>
+{
+    return std::make_shared<flight_recorder>(
+        std::move(target), pol, std::move(flt));
+}
+
+} // namespace zappy
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zappy/details/common.hpp>
+#include <zappy/details/core.hpp>
+
+namespace zappy {
+
+namespace details {
+
+// metrics_sink_impl does not log any records itself; instead, it periodically
+// writes the pipeline metrics of every core it is attached to into the
+// target sink
+struct metrics_sink_impl : public sink {
+    sink_ptr target;
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point next_report;
+    std::mutex mux;
+    std::vector<core const*> cores;
+
+    metrics_sink_impl(sink_ptr t, std::chrono::milliseconds i)
+        : sink{[](level) { return false; }}
+        , target{std::move(t)}
+        , interval{i}
+        , next_report{std::chrono::steady_clock::now() + i}
+    {
+    }
+
+    void attach(core& c) override
+    {
+        auto _ = std::unique_lock(mux);
+        cores.push_back(&c);
+    }
+
+    void detach(core& c) override
+    {
+        auto _ = std::unique_lock(mux);
+        std::erase(cores, &c);
+    }
+
+    void write(msg const&) override {}
+
+    void flush() override
+    {
+        auto _ = std::unique_lock(mux);
+        auto const now = std::chrono::steady_clock::now();
+        if (!target || now < next_report)
+            return;
+        next_report = now + interval;
+
+        for (std::size_t i = 0; i < cores.size(); ++i)
+            report(i, cores[i]->metrics());
+        flush_sink(*target);
+    }
+
+    // writes m into the target as the core would, counted by the target
+    void emit(msg& m)
+    {
+        m.logger_name = "zappy.metrics";
+        if (target->accepts(m))
+            deliver(*target, m);
+    }
+
+    void report(std::size_t core_index, core_metrics const& cm)
+    {
+        auto n = [](auto v) { return std::to_string(v); };
+        auto ns = [](std::chrono::nanoseconds v) {
+            return std::to_string(v.count());
+        };
+
+        auto m = msg{level::info, "pipeline metrics"};
+        m.add_attr("core", n(core_index))
+            .add_attr("enqueued", n(cm.enqueued))
+            .add_attr("dropped", n(cm.dropped))
+            .add_attr("queue_size", n(cm.queue_size))
+            .add_attr("queue_capacity", n(cm.queue_capacity))
+            .add_attr("queue_high_water", n(cm.queue_high_water))
+            .add_attr("blocked_pushes", n(cm.blocked_pushes))
+            .add_attr("blocked_ns", ns(cm.blocked_time))
+            .add_attr("sync_wait_p99_ns", ns(cm.sync_wait.percentile(0.99)));
+        emit(m);
+
+        for (std::size_t i = 0; i < cm.sinks.size(); ++i) {
+            auto const& sm = cm.sinks[i];
+            auto m = msg{level::info, "sink metrics"};
+            m.add_attr("core", n(core_index))
+                .add_attr("sink", n(i))
+                .add_attr("records", n(sm.records))
+                .add_attr("bytes", n(sm.bytes))
+                .add_attr("dropped", n(sm.dropped))
+                .add_attr("rotations", n(sm.rotations))
+                .add_attr("write_p50_ns", ns(sm.write_latency.percentile(0.5)))
+                .add_attr(
+                    "write_p99_ns", ns(sm.write_latency.percentile(0.99)))
+                .add_attr("write_max_ns", ns(sm.write_latency.max))
+                .add_attr(
+                    "flush_p99_ns", ns(sm.flush_latency.percentile(0.99)))
+                .add_attr("flush_max_ns", ns(sm.flush_latency.max))
+                .add_attr("syncs", n(sm.syncs))
+                .add_attr("sync_p99_ns", ns(sm.sync_latency.percentile(0.99)));
+            emit(m);
+        }
+    }
+};
+
+} // namespace details
+
+// metrics_sink periodically reports the pipeline metrics of the cores it is
+// connected to as "zappy.metrics" log records written to the target sink
+inline auto metrics_sink(sink_ptr target,
+    std::chrono::milliseconds interval = std::chrono::seconds{10}) -> sink_ptr
+{
+    return std::make_shared<details::metrics_sink_impl>(
+        std::move(target), interval);
+}
+
+} // namespace zappy
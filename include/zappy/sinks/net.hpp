@@ -0,0 +1,397 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <zappy/details/common.hpp>
+#include <zappy/details/fmt.hpp>
+#include <zappy/details/stringers.hpp>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace zappy {
+
+enum class net_framing {
+    ndjson, // newline-delimited to_json records
+    syslog, // RFC 5424, octet-counted (RFC 6587) on stream transports
+};
+
+struct net_sink_policy {
+    net_framing framing = net_framing::ndjson;
+    std::size_t batch_size = 64 * 1024;      // sent when exceeded
+    std::size_t max_backlog = 4 * 1024 * 1024; // dropped when exceeded
+    std::chrono::milliseconds min_backoff{100};
+    std::chrono::milliseconds max_backoff{10000};
+    int syslog_facility = 1; // user-level messages
+    std::string app_name = "-";
+};
+
+namespace details {
+
+// net_endpoint parses "tcp:host:port", "udp:host:port", "unix:/path" and
+// "unixgram:/path" endpoint specifications
+struct net_endpoint {
+    int family = AF_UNSPEC;
+    int socktype = SOCK_STREAM;
+    sockaddr_storage addr{};
+    socklen_t addr_len = 0;
+
+    auto is_stream() const -> bool { return socktype == SOCK_STREAM; }
+
+    static auto parse(std::string const& spec) -> net_endpoint
+    {
+        auto ep = net_endpoint{};
+        auto const colon = spec.find(':');
+        auto const scheme = spec.substr(0, colon);
+        auto const rest =
+            colon == std::string::npos ? std::string{} : spec.substr(colon + 1);
+
+        if (scheme == "unix" || scheme == "unixgram") {
+            auto sun = sockaddr_un{};
+            if (rest.empty() || rest.size() >= sizeof(sun.sun_path))
+                throw std::invalid_argument("zappy: invalid unix socket path: " + spec);
+            sun.sun_family = AF_UNIX;
+            std::memcpy(sun.sun_path, rest.data(), rest.size());
+            ep.family = AF_UNIX;
+            ep.socktype = scheme == "unix" ? SOCK_STREAM : SOCK_DGRAM;
+            std::memcpy(&ep.addr, &sun, sizeof(sun));
+            ep.addr_len = socklen_t(sizeof(sun));
+            return ep;
+        }
+
+        if (scheme != "tcp" && scheme != "udp")
+            throw std::invalid_argument("zappy: invalid endpoint: " + spec);
+
+        // host:port, with [v6-address]:port
+        auto const port_sep = rest.rfind(':');
+        if (port_sep == std::string::npos || port_sep + 1 == rest.size())
+            throw std::invalid_argument("zappy: missing port: " + spec);
+        auto host = rest.substr(0, port_sep);
+        if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        auto const port = rest.substr(port_sep + 1);
+
+        auto hints = addrinfo{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = scheme == "tcp" ? SOCK_STREAM : SOCK_DGRAM;
+        addrinfo* res = nullptr;
+        if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+            throw std::invalid_argument("zappy: cannot resolve: " + spec);
+        ep.family = res->ai_family;
+        ep.socktype = hints.ai_socktype;
+        std::memcpy(&ep.addr, res->ai_addr, res->ai_addrlen);
+        ep.addr_len = res->ai_addrlen;
+        ::freeaddrinfo(res);
+        return ep;
+    }
+};
+
+inline auto syslog_severity(level l) -> int
+{
+    switch (l) {
+    case level::debug:
+        return 7;
+    case level::info:
+        return 6;
+    case level::warn:
+        return 4;
+    case level::error:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+// appends a printable-ascii token of at most max_len characters, as required
+// for RFC 5424 header fields and SD-NAMEs; empty tokens become "-"
+inline void syslog_token(std::string& out, std::string_view sv,
+    std::size_t max_len, std::string_view exclude = {})
+{
+    auto n = std::size_t{0};
+    for (auto c : sv) {
+        if (n == max_len)
+            break;
+        if (c > 32 && c < 127 && exclude.find(c) == std::string_view::npos) {
+            out += c;
+            ++n;
+        }
+    }
+    if (!n)
+        out += '-';
+}
+
+// formats a record as an RFC 5424 message, attributes become the
+// structured-data element [zappy@32473 key="value" ...]
+inline void to_syslog(std::string& out, msg const& m, int facility,
+    std::string_view hostname, std::string_view app_name,
+    std::string_view procid)
+{
+    out.clear();
+    out += '<';
+    out += std::to_string(facility * 8 + syslog_severity(m.level));
+    out += ">1 ";
+
+    char buf[27];
+    auto [p, _] = to_chars(buf, buf + 27, m.timestamp);
+    out.append(buf, std::size_t(p - buf));
+    out += ' ';
+    syslog_token(out, hostname, 255);
+    out += ' ';
+    syslog_token(out, app_name, 48);
+    out += ' ';
+    syslog_token(out, procid, 128);
+    out += ' ';
+    syslog_token(out, m.logger_name, 32);
+
+    if (!m.attr_count()) {
+        out += " -";
+    }
+    else {
+        out += " [zappy@32473";
+        m.for_each_attr([&](attribute_view a) {
+            out += ' ';
+            syslog_token(out, a.key, 32, "= ]\"");
+            out += "=\"";
+            for (auto c : std::string_view(a.value)) {
+                if (c == '"' || c == '\\' || c == ']')
+                    out += '\\';
+                out += c;
+            }
+            out += '"';
+        });
+        out += ']';
+    }
+
+    if (!m.message.empty()) {
+        out += ' ';
+        out += m.message;
+    }
+}
+
+// net_sink_impl sends records to a relay over a unix, tcp or udp socket; all
+// socket operations are non-blocking, records are coalesced into large
+// writes and buffered up to a bound while the relay is unreachable
+struct net_sink_impl : public sink {
+    net_endpoint endpoint;
+    net_sink_policy pol;
+    std::string hostname;
+    std::string procid;
+
+    std::mutex mux;
+    int fd = -1;
+    bool connecting = false;
+    std::chrono::steady_clock::time_point next_attempt{};
+    std::chrono::milliseconds backoff{0};
+
+    std::string scratch;
+    std::string backlog;            // pending frames, back to back
+    std::deque<std::size_t> frames; // sizes of the frames in backlog
+    std::size_t front_sent = 0;     // bytes of the front frame already sent
+
+    net_sink_impl(std::string const& spec, net_sink_policy const& p,
+        level_filter&& flt)
+        : sink{std::move(flt)}
+        , endpoint{net_endpoint::parse(spec)}
+        , pol{p}
+        , procid{std::to_string(::getpid())}
+    {
+        char host[256] = {};
+        if (::gethostname(host, sizeof(host) - 1) == 0)
+            hostname = host;
+    }
+
+    ~net_sink_impl()
+    {
+        auto _ = std::unique_lock(mux);
+        send_pending();
+        disconnect();
+    }
+
+    void write(msg const& m) override
+    {
+        auto _ = std::unique_lock(mux);
+        format(m);
+        if (backlog.size() + scratch.size() > pol.max_backlog) {
+            counters.dropped.add();
+            return;
+        }
+        backlog += scratch;
+        frames.push_back(scratch.size());
+        counters.bytes.add(scratch.size());
+        if (backlog.size() >= pol.batch_size)
+            send_pending();
+    }
+
+    void flush() override
+    {
+        auto _ = std::unique_lock(mux);
+        send_pending();
+    }
+
+    void format(msg const& m)
+    {
+        if (pol.framing == net_framing::ndjson) {
+            to_json(scratch, m);
+            scratch += '\n';
+            return;
+        }
+        to_syslog(scratch, m, pol.syslog_facility, hostname, pol.app_name,
+            procid);
+        if (endpoint.is_stream())
+            scratch.insert(0, std::to_string(scratch.size()) + ' ');
+    }
+
+    void disconnect()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        connecting = false;
+
+        // a partially sent frame can not be resumed on a new connection
+        if (front_sent) {
+            backlog.erase(0, frames.front() - front_sent);
+            frames.pop_front();
+            front_sent = 0;
+            counters.dropped.add();
+        }
+    }
+
+    void schedule_reconnect()
+    {
+        disconnect();
+        backoff = backoff.count() ? std::min(backoff * 2, pol.max_backoff)
+                                  : pol.min_backoff;
+        next_attempt = std::chrono::steady_clock::now() + backoff;
+    }
+
+    // advances the connection state machine without blocking, returns true
+    // once the socket is ready for sending
+    auto ready() -> bool
+    {
+        if (fd >= 0 && !connecting)
+            return true;
+
+        if (fd < 0) {
+            if (std::chrono::steady_clock::now() < next_attempt)
+                return false;
+            fd = ::socket(endpoint.family,
+                endpoint.socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                schedule_reconnect();
+                return false;
+            }
+            if (endpoint.family != AF_UNIX && endpoint.is_stream()) {
+                int one = 1;
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            if (::connect(fd, reinterpret_cast<sockaddr const*>(&endpoint.addr),
+                    endpoint.addr_len) == 0) {
+                backoff = {};
+                return true;
+            }
+            if (errno != EINPROGRESS && errno != EAGAIN) {
+                schedule_reconnect();
+                return false;
+            }
+            connecting = true;
+        }
+
+        auto pfd = pollfd{fd, POLLOUT, 0};
+        if (::poll(&pfd, 1, 0) <= 0)
+            return false;
+        int err = 0;
+        auto len = socklen_t(sizeof(err));
+        if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err) {
+            schedule_reconnect();
+            return false;
+        }
+        connecting = false;
+        backoff = {};
+        return true;
+    }
+
+    void send_pending()
+    {
+        if (frames.empty() || !ready())
+            return;
+
+        if (endpoint.is_stream()) {
+            // as many frames as the socket takes, in one go
+            auto sent_total = std::size_t{0};
+            while (sent_total < backlog.size()) {
+                auto const n = ::send(fd, backlog.data() + sent_total,
+                    backlog.size() - sent_total, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n > 0) {
+                    sent_total += std::size_t(n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+                consume(sent_total);
+                schedule_reconnect();
+                return;
+            }
+            consume(sent_total);
+            return;
+        }
+
+        // datagrams carry exactly one frame each
+        while (!frames.empty()) {
+            auto const size = frames.front();
+            auto const n =
+                ::send(fd, backlog.data(), size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n < 0 && errno != EMSGSIZE) {
+                schedule_reconnect();
+                return;
+            }
+            if (n < 0)
+                counters.dropped.add();
+            backlog.erase(0, size);
+            frames.pop_front();
+        }
+    }
+
+    // removes n sent bytes from the front of the backlog
+    void consume(std::size_t n)
+    {
+        backlog.erase(0, n);
+        n += front_sent;
+        while (!frames.empty() && n >= frames.front()) {
+            n -= frames.front();
+            frames.pop_front();
+        }
+        front_sent = n;
+    }
+};
+
+} // namespace details
+
+// net_sink ships records to a local or remote relay; endpoint is one of
+// "unix:/path", "unixgram:/path", "tcp:host:port" or "udp:host:port"
+inline auto net_sink(std::string const& endpoint,
+    net_sink_policy const& pol = {}, level_filter&& flt = {}) -> sink_ptr
+{
+    return std::make_shared<details::net_sink_impl>(
+        endpoint, pol, std::move(flt));
+}
+
+} // namespace zappy
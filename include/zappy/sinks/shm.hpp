@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <zappy/details/common.hpp>
+#include <zappy/details/record-codec.hpp>
+#include <zappy/details/shm-ring.hpp>
+
+namespace zappy {
+
+namespace details {
+
+// shm_sink_impl hands records over to an out-of-process collector (see
+// tools/zappy-collector) through a shared-memory ring, without formatting
+// them; records that do not fit into the ring are dropped
+struct shm_sink_impl : public sink {
+    shm_ring ring;
+    std::mutex write_mux;
+    std::string scratch;
+
+    shm_sink_impl(
+        std::string const& name, std::size_t capacity, level_filter&& flt)
+        : sink{std::move(flt)}
+    {
+        if (!ring.create(name, capacity))
+            throw std::runtime_error("zappy: failed to create shared memory "
+                                     "ring " +
+                                     name);
+    }
+
+    void write(msg const& m) override
+    {
+        auto _ = std::unique_lock(write_mux);
+        scratch.clear();
+        encode_record(scratch, m);
+        if (ring.try_write(scratch))
+            counters.bytes.add(scratch.size());
+        else
+            counters.dropped.add();
+    }
+
+    // records are visible to the collector as soon as they are written
+    void flush() override {}
+};
+
+} // namespace details
+
+// shm_sink writes encoded records into the POSIX shared-memory object name
+// (e.g. "/myapp-log"), to be formatted and stored by zappy-collector
+inline auto shm_sink(std::string const& name,
+    std::size_t capacity = 4 * 1024 * 1024, level_filter&& flt = {})
+    -> sink_ptr
+{
+    return std::make_shared<details::shm_sink_impl>(
+        name, capacity, std::move(flt));
+}
+
+} // namespace zappy
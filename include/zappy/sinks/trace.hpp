@@ -0,0 +1,156 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <zappy/details/common.hpp>
+#include <zappy/details/json-scrambler.hpp>
+#include <zappy/details/span.hpp>
+#include <zappy/details/stringers.hpp>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace zappy {
+
+namespace details {
+
+// trace_event_sink_impl writes records as Chrome trace events, in the JSON
+// array format: spans (records with a span id) become complete ("X") events
+// on the thread that timed them, other records instant ("i") events on the
+// thread that logged them. The array is closed when the sink is destroyed;
+// trace viewers also load files cut short by a crash
+struct trace_event_sink_impl : public sink {
+    std::ofstream out;
+    std::mutex write_mux;
+    std::string scratch;
+    std::string pid;
+    bool first = true;
+
+    trace_event_sink_impl(std::filesystem::path const& fn, level_filter&& flt)
+        : sink{std::move(flt)}
+#ifdef _WIN32
+        , pid{std::to_string(::_getpid())}
+#else
+        , pid{std::to_string(::getpid())}
+#endif
+    {
+        auto ec = std::error_code{};
+        if (fn.has_parent_path())
+            std::filesystem::create_directories(fn.parent_path(), ec);
+        out.open(fn, std::ios::binary | std::ios::trunc);
+        out << "[";
+    }
+
+    ~trace_event_sink_impl() { out << "\n]\n"; }
+
+    // microseconds with three decimals, as trace viewers expect
+    static void put_us(std::string& s, std::int64_t ns)
+    {
+        char buf[24];
+        auto const us = std::to_chars(buf, buf + sizeof(buf), ns / 1000).ptr;
+        s.append(buf, us);
+        auto const frac = ns % 1000;
+        s += '.';
+        s += char('0' + frac / 100);
+        s += char('0' + frac / 10 % 10);
+        s += char('0' + frac % 10);
+    }
+
+    void format(std::string& s, msg const& m)
+    {
+        auto w = [&](std::string_view sv) { s += sv; };
+        // the duration and thread attributes only have a meaning for spans,
+        // other records keep them as arguments
+        auto span = false;
+        auto duration = std::int64_t{0};
+        auto span_thread = std::uint64_t{0};
+        m.for_each_attr([&](attribute_view a) {
+            if (a.key == span_id_key)
+                span = true;
+            else if (a.key == span_duration_key)
+                std::from_chars(
+                    a.value.data(), a.value.data() + a.value.size(), duration);
+            else if (a.key == span_thread_key)
+                std::from_chars(a.value.data(),
+                    a.value.data() + a.value.size(), span_thread);
+        });
+        auto const thread = span && span_thread ? span_thread
+                                                : std::uint64_t{m.thread};
+
+        auto ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            m.timestamp.time_since_epoch())
+                      .count();
+        s.clear();
+        s += first ? "\n{\"name\":\"" : ",\n{\"name\":\"";
+        details::json_scramble(w, m.message);
+        s += "\",\"cat\":\"";
+        details::json_scramble(w, m.logger_name);
+        if (span) {
+            s += "\",\"ph\":\"X\",\"ts\":";
+            put_us(s, ts - duration);
+            s += ",\"dur\":";
+            put_us(s, duration);
+        }
+        else {
+            s += "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":";
+            put_us(s, ts);
+        }
+        s += ",\"pid\":";
+        s += pid;
+        s += ",\"tid\":";
+        char buf[24];
+        s += number_sv(buf, thread);
+        s += ",\"args\":{\"level\":\"";
+        s += to_sv(m.level);
+        s += '"';
+        m.for_each_attr([&](attribute_view a) {
+            if (span &&
+                (a.key == span_duration_key || a.key == span_thread_key))
+                return;
+            s += ",\"";
+            details::json_scramble(w, a.key);
+            s += "\":\"";
+            details::json_scramble(w, a.value);
+            s += '"';
+        });
+        s += "}}";
+        first = false;
+    }
+
+    void write(msg const& m) override
+    {
+        auto _ = std::unique_lock(write_mux);
+        format(scratch, m);
+        out << scratch;
+        counters.bytes.add(scratch.size());
+    }
+
+    void flush() override
+    {
+        auto _ = std::unique_lock(write_mux);
+        out.flush();
+    }
+};
+
+} // namespace details
+
+// trace_event_sink writes a trace of the spans logged (see log_span) that
+// chrome://tracing and ui.perfetto.dev open; records other than spans are
+// marked as instants. The file is truncated when the sink is created
+inline auto trace_event_sink(
+    std::filesystem::path const& fn, level_filter&& flt = {}) -> sink_ptr
+{
+    return std::make_shared<details::trace_event_sink_impl>(
+        fn, std::move(flt));
+}
+
+} // namespace zappy
@@ -0,0 +1,60 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/aggregate.hpp>
+#include <zappy/sinks/func.hpp>
+
+#include "check.hpp"
+
+// summaries of the aggregate sink reach its target like records from a core
+
+namespace {
+
+using namespace std::chrono_literals;
+using zappy_test::check;
+using strings = std::vector<std::string>;
+
+void final_report()
+{
+    auto got = strings{};
+    auto flushes = 0;
+    auto const target = zappy::func_sink(
+        [&](zappy::msg const& m) {
+            auto count = std::string{};
+            m.for_each_attr([&](zappy::attribute_view a) {
+                if (a.key == "count")
+                    count = a.value;
+            });
+            got.push_back(std::string(m.message) + "=" + count);
+        },
+        [&] { ++flushes; });
+    target->levels = zappy::levels(zappy::level::info);
+    target->filter = "msg != skipped";
+    auto pol = zappy::aggregate_policy{};
+    pol.interval = 1h;
+    {
+        auto const agg = zappy::aggregate_sink(target, pol);
+        auto const core = zappy::make_core(zappy::core_options{}, {agg});
+        auto const lg = zappy::logger{"agg", core};
+        for (auto i = 0; i < 3; ++i) {
+            lg.info("kept");
+            lg.info("skipped");
+            lg.debug("debug");
+        }
+        zappy::core::flush();
+        check(got.empty() && !flushes, "nothing before the interval ends");
+    }
+    check(got == strings{"kept=3"},
+        "final report: filtered by the target's levels and filter");
+    check(target->metrics().records == 1, "final report: counted");
+    check(flushes == 1, "final report: target flushed after it");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    final_report();
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// counts heap allocations made anywhere in the process; every form of
+// operator new and delete is replaced, so that they pair up. Replacements
+// are not inline: include this in one translation unit of a program only
+
+namespace zappy_test {
+
+inline std::atomic<std::size_t> allocations{0};
+
+inline auto counted_alloc(std::size_t n, std::size_t align = 0) -> void*
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    n = n ? n : 1;
+    auto p = align <= alignof(std::max_align_t)
+                 ? std::malloc(n)
+                 : std::aligned_alloc(align, (n + align - 1) / align * align);
+    if (!p)
+        throw std::bad_alloc{};
+    return p;
+}
+
+} // namespace zappy_test
+
+auto operator new(std::size_t n) -> void*
+{
+    return zappy_test::counted_alloc(n);
+}
+auto operator new[](std::size_t n) -> void*
+{
+    return zappy_test::counted_alloc(n);
+}
+auto operator new(std::size_t n, std::align_val_t a) -> void*
+{
+    return zappy_test::counted_alloc(n, std::size_t(a));
+}
+auto operator new[](std::size_t n, std::align_val_t a) -> void*
+{
+    return zappy_test::counted_alloc(n, std::size_t(a));
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
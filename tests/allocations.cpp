@@ -0,0 +1,72 @@
+#include <filesystem>
+#include <string>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/file.hpp>
+#include <zappy/sinks/func.hpp>
+
+#include <unistd.h>
+
+#include "alloc-count.hpp"
+#include "check.hpp"
+
+// fails when logging allocates once the core has recycled its queue slots
+
+namespace {
+
+using zappy_test::check;
+
+// allocations of 10000 log calls through a warmed up core, attributes and
+// context included, until the records reached the sink
+auto steady_state(zappy::core_options const& co, zappy::sink_ptr sink,
+    zappy::level l = zappy::level::info) -> std::size_t
+{
+    auto core = zappy::make_core(co, {std::move(sink)});
+    auto lg = zappy::logger{"alloc", core}.with_attributes(
+        {{"request_id", "0f8fad5b-d9cb-469f-a165-70867728950e"},
+            {"peer", "10.0.0.1:55312"}});
+    auto log = [&] {
+        lg.log(l, "request finished after a rather long time in the backend",
+            {{"path", "/api/v1/items?id=42&expand=owner"}, {"status", "200"}});
+    };
+    for (std::size_t i = 0; i < 2 * co.queue_size; ++i)
+        log();
+    zappy::core::flush();
+
+    auto const before = zappy_test::allocations.load();
+    for (auto i = 0; i < 10000; ++i)
+        log();
+    zappy::core::flush();
+    return zappy_test::allocations.load() - before;
+}
+
+auto null_sink() -> zappy::sink_ptr
+{
+    return zappy::func_sink([](zappy::msg const&) {}, {});
+}
+
+} // namespace
+
+auto main() -> int
+{
+    check(steady_state({}, null_sink()) == 0, "heap records");
+
+    auto arena = zappy::arena_resource{};
+    check(steady_state({.memory = &arena}, null_sink()) == 0, "arena records");
+
+    check(steady_state({}, null_sink(), zappy::level::error) == 0,
+        "error lane");
+
+    auto const dir = std::filesystem::temp_directory_path() /
+                     ("zappy-test-alloc-" + std::to_string(::getpid()));
+    check(steady_state({},
+              zappy::rotating_text_file_sink(dir / "alloc.log",
+                  {.max_size = 1 << 30})) == 0,
+        "text file sink");
+    check(steady_state({},
+              zappy::rotating_json_file_sink(dir / "alloc.jsonl",
+                  {.max_size = 1 << 30})) == 0,
+        "json file sink");
+    std::filesystem::remove_all(dir);
+
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <source_location>
+#include <string_view>
+#include <thread>
+
+namespace zappy_test {
+
+inline int failures = 0;
+
+// reports a failed expectation; a test fails when any check did
+inline auto check(bool ok, std::string_view what,
+    std::source_location loc = std::source_location::current()) -> bool
+{
+    if (!ok) {
+        ++failures;
+        std::fprintf(stderr, "%s:%u: check failed: %.*s\n", loc.file_name(),
+            unsigned(loc.line()), int(what.size()), what.data());
+    }
+    return ok;
+}
+
+// calls f until it returns true or the timeout expires, returns the last
+// result of f
+template <typename F>
+auto eventually(F&& f,
+    std::chrono::milliseconds timeout = std::chrono::seconds{5}) -> bool
+{
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (!f()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    return true;
+}
+
+} // namespace zappy_test
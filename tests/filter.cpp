@@ -0,0 +1,230 @@
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/func.hpp>
+
+#include "check.hpp"
+
+// filter expressions: parsing, evaluation, partial evaluation for routing,
+// and replacing filters while records are logged
+
+namespace {
+
+using zappy_test::check;
+using zappy::details::tri;
+
+auto record(std::string_view logger, zappy::level l, std::string_view message,
+    std::initializer_list<zappy::attribute_view> aa = {}) -> zappy::msg
+{
+    auto m = zappy::msg{l, message, aa};
+    m.logger_name = logger;
+    return m;
+}
+
+auto matches(std::string_view expr, zappy::msg const& m) -> bool
+{
+    return zappy::record_filter{expr}.matches(m);
+}
+
+// the message of the error compile throws for expr, empty if it compiles
+auto error_of(std::string_view expr) -> std::string
+{
+    try {
+        zappy::record_filter{expr};
+    }
+    catch (std::invalid_argument const& e) {
+        return e.what();
+    }
+    return {};
+}
+
+void precedence()
+{
+    auto const m = record("net", zappy::level::debug, "connected");
+    // && binds tighter than ||
+    check(matches("logger == net || logger == db && level >= error", m),
+        "precedence: a || b && c is a || (b && c)");
+    check(!matches("(logger == net || logger == db) && level >= error", m),
+        "precedence: parentheses group");
+    check(matches("logger == db && level >= error || logger == net", m),
+        "precedence: a && b || c is (a && b) || c");
+
+    check(matches("!(level >= warn)", m), "not: of a group");
+    check(!matches("!logger == net", m), "not: binds to the comparison");
+    check(matches("!!logger == net", m), "not: twice");
+    check(matches("!logger == db && message == connected", m),
+        "not: before &&");
+    check(matches("", m), "empty expression lets everything through");
+}
+
+void string_operators()
+{
+    auto ctx = std::make_shared<zappy::details::attr_context>();
+    ctx->attributes.push_back({"tenant", "acme-corp"});
+    auto m = record("com.example.db", zappy::level::warn,
+        "query took \"long\"", {{"table", "users"}});
+    m.context = ctx;
+
+    check(matches("logger == com.example.db", m), "logger ==");
+    check(matches("logger != com.example", m), "logger !=");
+    check(matches("logger ^= com.example", m), "logger ^=");
+    check(!matches("logger ^= example", m), "logger ^= is a prefix");
+    check(matches("logger $= .db", m), "logger $=");
+    check(matches("logger *= example", m), "logger *=");
+
+    check(matches("message == \"query took \\\"long\\\"\"", m),
+        "msg == with escaped quotes");
+    check(matches("msg ^= \"query took\"", m), "msg ^= quoted");
+    check(matches("msg *= long", m), "msg *=");
+    check(!matches("msg *= short", m), "msg *= misses");
+
+    check(matches("attr.table == users", m), "attr ==");
+    check(matches("attr.table ^= use", m), "attr ^=");
+    check(matches("attr.table *= ser", m), "attr *=");
+    check(matches("attr.tenant == acme-corp", m), "context attr ==");
+    check(matches("attr.tenant ^= acme", m), "context attr ^=");
+    check(matches("attr.tenant *= corp && attr.table == users", m),
+        "record and context attrs together");
+
+    check(!matches("attr.missing == x", m), "missing attr equals nothing");
+    check(matches("attr.missing != x", m), "missing attr differs");
+    check(!matches("attr.missing ^= \"\"", m), "missing attr has no prefix");
+}
+
+void level_operators()
+{
+    auto const m = record("net", zappy::level::warn, "x");
+    check(matches("level == warn", m), "level ==");
+    check(matches("level != info", m), "level !=");
+    check(matches("level >= warn && level <= warn", m), "level >= <=");
+    check(matches("level > info && level < error", m), "level > <");
+    check(matches("level >= WARN", m), "level names ignore case");
+}
+
+void parse_errors()
+{
+    auto expect = [](std::string_view expr, std::string const& what) {
+        auto const e = error_of(expr);
+        check(e == "zappy: filter: " + what + ": " + std::string(expr),
+            "parse error: " + std::string(expr) + " -> " + e);
+    };
+    expect("logger ==", "expected a value at 9");
+    expect("logger = net", "expected an operator at 7");
+    expect("level >= loud", "unknown level at 13");
+    expect("level ^= warn", "string operator on level at 8");
+    expect("message < x", "ordering operator on a string field at 9");
+    expect("host == a", "unknown field at 4");
+    expect("(logger == a", "expected ')' at 12");
+    expect("logger == a)", "unexpected input at 11");
+    expect("logger == \"a", "unterminated string at 12");
+    expect("logger == a &&", "expected a field at 14");
+
+    auto deep = std::string{};
+    for (auto i = 0; i < 40; ++i)
+        deep += "logger == a || (";
+    deep += "logger == a";
+    deep.append(40, ')');
+    check(error_of(deep).find("expression too deep") != std::string::npos,
+        "parse error: too deep");
+
+    // a failed set keeps the current program
+    auto f = zappy::record_filter{"level >= error"};
+    try {
+        f = "level >=";
+    }
+    catch (std::invalid_argument const&) {
+    }
+    check(!f.matches(record("a", zappy::level::info, "x")),
+        "failed set keeps the program");
+}
+
+void partial()
+{
+    auto const f =
+        zappy::record_filter{"logger ^= net && (level >= warn || msg *= x)"};
+    check(f.partial("db", zappy::level::error) == tri::no,
+        "partial: logger decides");
+    check(f.partial("net.tcp", zappy::level::error) == tri::yes,
+        "partial: logger and level decide");
+    check(f.partial("net.tcp", zappy::level::info) == tri::maybe,
+        "partial: message unknown");
+    auto const unknown = zappy::record_filter{"!(msg *= x)"};
+    check(unknown.partial("a", zappy::level::info) == tri::maybe,
+        "partial: not of unknown");
+    auto const empty = zappy::record_filter{};
+    check(empty.partial("a", zappy::level::info) == tri::yes,
+        "partial: empty filter");
+}
+
+// the programs are replaced while other threads evaluate them
+void replace_concurrently()
+{
+    auto f = zappy::record_filter{"level >= warn"};
+    auto stop = std::atomic<bool>{false};
+    auto const m = record("net", zappy::level::error, "x");
+    auto misses = std::atomic<int>{0};
+    auto readers = std::vector<std::thread>{};
+    for (auto i = 0; i < 3; ++i)
+        readers.emplace_back([&] {
+            while (!stop) {
+                // every program installed below takes the record
+                if (!f.matches(m))
+                    ++misses;
+                f.partial("net", zappy::level::error);
+            }
+        });
+    for (auto i = 0; i < 5000; ++i)
+        f.set(i % 3 == 0   ? "level >= error"
+              : i % 3 == 1 ? ""
+                           : "logger == net && msg == x");
+    stop = true;
+    for (auto& t : readers)
+        t.join();
+    check(misses == 0, "replace: readers see whole programs");
+}
+
+// filters of a core and its sinks changed while logging: the routes derived
+// from them follow
+void replace_in_core()
+{
+    auto got = std::vector<std::string>{};
+    auto sink = zappy::func_sink(
+        [&](zappy::msg const& m) { got.emplace_back(m.logger_name); }, {});
+    auto core = zappy::make_core(zappy::core_options{}, {sink});
+    auto const a = zappy::logger{"a", core};
+    auto const b = zappy::logger{"b", core};
+    auto log_both = [&] {
+        a.info("x");
+        b.info("x");
+        zappy::core::flush();
+    };
+
+    log_both();
+    sink->filter = "logger == a";
+    log_both();
+    core->filter = "logger != a";
+    log_both();
+    core->filter.clear();
+    sink->filter.clear();
+    log_both();
+    check(got == std::vector<std::string>{"a", "b", "a", "a", "b"},
+        "replace: routes follow the filters");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    precedence();
+    string_operators();
+    level_operators();
+    parse_errors();
+    partial();
+    replace_concurrently();
+    replace_in_core();
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/func.hpp>
+#include <zappy/sinks/metrics.hpp>
+
+#include "check.hpp"
+
+// reports of the metrics sink reach its target like records from a core
+
+namespace {
+
+using namespace std::chrono_literals;
+using zappy_test::check;
+using strings = std::vector<std::string>;
+
+void reports()
+{
+    auto got = strings{};
+    auto flushes = 0;
+    auto const target = zappy::func_sink(
+        [&](zappy::msg const& m) { got.emplace_back(m.message); },
+        [&] { ++flushes; });
+    target->filter = "msg == \"sink metrics\"";
+
+    auto const core = zappy::make_core(zappy::core_options{},
+        {zappy::metrics_sink(target, 0ms),
+            zappy::func_sink([](zappy::msg const&) {}, {})});
+    zappy::logger{"metrics", core}.info("x");
+    zappy::core::flush();
+
+    check(!got.empty() && got == strings(got.size(), "sink metrics"),
+        "reports: filtered by the target");
+    check(target->metrics().records == got.size(), "reports: counted");
+    check(flushes > 0, "reports: target flushed");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    reports();
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zappy/details/fmt.hpp>
+#include <zappy/sinks/net.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "check.hpp"
+
+// drives net_sink against unix, tcp and udp listeners on this host
+
+namespace {
+
+using namespace std::chrono_literals;
+using zappy_test::check;
+using zappy_test::eventually;
+
+struct socket_fd {
+    int fd = -1;
+
+    socket_fd() = default;
+    explicit socket_fd(int f)
+        : fd{f}
+    {
+    }
+    socket_fd(socket_fd&& o) noexcept
+        : fd{std::exchange(o.fd, -1)}
+    {
+    }
+    auto operator=(socket_fd&& o) noexcept -> socket_fd&
+    {
+        std::swap(fd, o.fd);
+        return *this;
+    }
+    ~socket_fd()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+auto record(int i) -> zappy::msg
+{
+    auto const seq = std::to_string(i);
+    auto m = zappy::msg{zappy::level::info, "record " + seq, {{"seq", seq}}};
+    m.logger_name = "net";
+    return m;
+}
+
+// writes records [from, to) into s, returns them as ndjson
+auto write_records(zappy::sink& s, int from, int to) -> std::string
+{
+    auto ndjson = std::string{};
+    auto json = std::string{};
+    for (auto i = from; i < to; ++i) {
+        auto const m = record(i);
+        s.write(m);
+        zappy::to_json(json, m);
+        ndjson += json;
+        ndjson += '\n';
+    }
+    return ndjson;
+}
+
+auto socket_path(std::string_view name) -> std::string
+{
+    auto const p = std::filesystem::temp_directory_path() /
+                   ("zappy-test-" + std::to_string(::getpid()) + "-" +
+                       std::string(name) + ".sock");
+    std::filesystem::remove(p);
+    return p.string();
+}
+
+auto listen_unix(std::string const& path) -> socket_fd
+{
+    auto s = socket_fd{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    auto sun = sockaddr_un{};
+    sun.sun_family = AF_UNIX;
+    path.copy(sun.sun_path, sizeof(sun.sun_path) - 1);
+    if (::bind(s.fd, reinterpret_cast<sockaddr*>(&sun), sizeof(sun)) != 0 ||
+        ::listen(s.fd, 8) != 0)
+        check(false, "unix listener");
+    return s;
+}
+
+// binds to 127.0.0.1:port, port 0 for any; listens on stream sockets
+auto bind_inet(int type, std::uint16_t port = 0) -> socket_fd
+{
+    auto s = socket_fd{::socket(AF_INET, type | SOCK_CLOEXEC, 0)};
+    int one = 1;
+    ::setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    auto sin = sockaddr_in{};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(s.fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)) != 0 ||
+        (type == SOCK_STREAM && ::listen(s.fd, 8) != 0))
+        check(false, "inet listener");
+    return s;
+}
+
+auto port_of(socket_fd const& s) -> std::uint16_t
+{
+    auto sin = sockaddr_in{};
+    auto len = socklen_t(sizeof(sin));
+    ::getsockname(s.fd, reinterpret_cast<sockaddr*>(&sin), &len);
+    return ntohs(sin.sin_port);
+}
+
+// a connection pending on the listener, or an empty socket_fd
+auto accept_now(socket_fd const& listener) -> socket_fd
+{
+    auto pfd = pollfd{listener.fd, POLLIN, 0};
+    if (::poll(&pfd, 1, 0) <= 0)
+        return {};
+    return socket_fd{::accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC)};
+}
+
+// appends what arrived on a stream socket
+void receive(socket_fd const& s, std::string& into)
+{
+    char buf[4096];
+    while (true) {
+        auto const n = ::recv(s.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n <= 0)
+            return;
+        into.append(buf, std::size_t(n));
+    }
+}
+
+// flushes s until the records it sends to listener add up to n bytes
+auto pump(zappy::sink& s, socket_fd const& listener, socket_fd& conn,
+    std::string& got, std::size_t n) -> bool
+{
+    return eventually([&] {
+        s.flush();
+        if (conn.fd < 0)
+            conn = accept_now(listener);
+        if (conn.fd >= 0)
+            receive(conn, got);
+        return got.size() >= n;
+    });
+}
+
+// splits RFC 6587 octet-counted frames, false for malformed or partial input
+auto split_counted(std::string_view in, std::vector<std::string>& frames)
+    -> bool
+{
+    frames.clear();
+    while (!in.empty()) {
+        auto const sp = in.find(' ');
+        auto n = std::size_t{0};
+        if (sp == std::string_view::npos ||
+            std::from_chars(in.data(), in.data() + sp, n).ptr !=
+                in.data() + sp ||
+            sp + 1 + n > in.size())
+            return false;
+        frames.emplace_back(in.substr(sp + 1, n));
+        in.remove_prefix(sp + 1 + n);
+    }
+    return true;
+}
+
+void unix_stream()
+{
+    auto const path = socket_path("unix");
+    auto const listener = listen_unix(path);
+    auto const s = zappy::net_sink(
+        "unix:" + path, {.min_backoff = 50ms, .max_backoff = 50ms});
+
+    auto const expected = write_records(*s, 0, 100);
+    auto conn = socket_fd{};
+    auto got = std::string{};
+    check(pump(*s, listener, conn, got, expected.size()),
+        "unix: records arrive");
+    check(got == expected, "unix: one json record per line");
+
+    // the relay goes away; the record is kept and sent on a new connection
+    // once the backoff is over
+    conn = socket_fd{};
+    auto const again = write_records(*s, 100, 101);
+    s->flush();
+    auto const failed = std::chrono::steady_clock::now();
+    s->flush();
+    check(accept_now(listener).fd < 0, "unix: no reconnect before backoff");
+    got.clear();
+    check(pump(*s, listener, conn, got, again.size()),
+        "unix: reconnects after the relay closed");
+    check(std::chrono::steady_clock::now() - failed >= 50ms,
+        "unix: waits for the backoff");
+    check(got == again, "unix: record kept across reconnect");
+    check(s->metrics().dropped == 0, "unix: nothing dropped");
+    std::filesystem::remove(path);
+}
+
+void tcp_syslog()
+{
+    auto const listener = bind_inet(SOCK_STREAM);
+    auto const s =
+        zappy::net_sink("tcp:127.0.0.1:" + std::to_string(port_of(listener)),
+            {.framing = zappy::net_framing::syslog, .app_name = "zappy-test"});
+
+    auto conn = socket_fd{};
+    auto got = std::string{};
+    auto frames = std::vector<std::string>{};
+    write_records(*s, 0, 50);
+    check(eventually([&] {
+        s->flush();
+        if (conn.fd < 0)
+            conn = accept_now(listener);
+        if (conn.fd >= 0)
+            receive(conn, got);
+        return split_counted(got, frames) && frames.size() >= 50;
+    }),
+        "tcp: octet-counted frames arrive");
+    check(frames.size() == 50, "tcp: one frame per record");
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        auto const& f = frames[i];
+        auto const seq = std::to_string(i);
+        check(f.starts_with("<14>1 "), "tcp: user.info priority, version 1");
+        check(f.find(" zappy-test ") != std::string::npos, "tcp: app name");
+        check(f.find("[zappy@32473 seq=\"" + seq + "\"]") != std::string::npos,
+            "tcp: attributes as structured data");
+        check(f.ends_with(" record " + seq), "tcp: message last");
+    }
+}
+
+void udp_datagrams()
+{
+    auto const listener = bind_inet(SOCK_DGRAM);
+    auto const ep = "udp:127.0.0.1:" + std::to_string(port_of(listener));
+    auto const ndjson = zappy::net_sink(ep);
+    auto const syslog =
+        zappy::net_sink(ep, {.framing = zappy::net_framing::syslog});
+
+    auto datagrams = std::vector<std::string>{};
+    auto receive_datagrams = [&](std::size_t n) {
+        return eventually([&] {
+            char buf[65536];
+            auto const r = ::recv(listener.fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (r > 0)
+                datagrams.emplace_back(buf, std::size_t(r));
+            return datagrams.size() >= n;
+        });
+    };
+
+    auto json = std::string{};
+    write_records(*ndjson, 0, 10);
+    ndjson->flush();
+    check(receive_datagrams(10), "udp: json datagrams arrive");
+    for (std::size_t i = 0; i < datagrams.size(); ++i) {
+        zappy::to_json(json, record(int(i)));
+        // the timestamps differ
+        auto const body = json.substr(json.find("\",") + 1);
+        check(datagrams[i].ends_with(body + '\n'),
+            "udp: one json record per datagram");
+    }
+
+    datagrams.clear();
+    write_records(*syslog, 0, 10);
+    syslog->flush();
+    check(receive_datagrams(10), "udp: syslog datagrams arrive");
+    for (std::size_t i = 0; i < datagrams.size(); ++i)
+        check(datagrams[i].starts_with("<14>1 ") &&
+                  datagrams[i].ends_with(" record " + std::to_string(i)),
+            "udp: one syslog message per datagram, not octet-counted");
+}
+
+void tcp_backoff()
+{
+    // a port that nothing listens on until later
+    auto port = std::uint16_t{0};
+    {
+        auto const probe = bind_inet(SOCK_STREAM);
+        port = port_of(probe);
+    }
+    auto const s = zappy::net_sink("tcp:127.0.0.1:" + std::to_string(port),
+        {.min_backoff = 10ms, .max_backoff = 40ms});
+    auto const expected = write_records(*s, 0, 10);
+
+    // refused for long enough that the backoff would have grown past a
+    // second without the cap
+    auto const refused_until = std::chrono::steady_clock::now() + 1300ms;
+    while (std::chrono::steady_clock::now() < refused_until) {
+        s->flush();
+        std::this_thread::sleep_for(1ms);
+    }
+
+    auto const listener = bind_inet(SOCK_STREAM, port);
+    auto const up = std::chrono::steady_clock::now();
+    auto conn = socket_fd{};
+    auto got = std::string{};
+    check(pump(*s, listener, conn, got, expected.size()),
+        "tcp: connects once the relay is up");
+    check(std::chrono::steady_clock::now() - up < 500ms,
+        "tcp: backoff capped by max_backoff");
+    check(got == expected, "tcp: records kept while refused");
+    check(s->metrics().dropped == 0, "tcp: nothing dropped");
+}
+
+void bounded_backlog()
+{
+    auto const path = socket_path("backlog");
+    auto const s = zappy::net_sink("unix:" + path,
+        {.batch_size = 1 << 20,
+            .max_backlog = 4096,
+            .min_backoff = 1ms,
+            .max_backoff = 1ms});
+
+    // nothing listens yet
+    auto const all = write_records(*s, 0, 200);
+    s->flush();
+    auto const dropped = s->metrics().dropped;
+    check(dropped > 0 && dropped < 200, "backlog: newest records dropped");
+
+    auto const listener = listen_unix(path);
+    auto conn = socket_fd{};
+    auto got = std::string{};
+    auto const kept = 200 - dropped;
+    auto lines = std::size_t{0};
+    check(eventually([&] {
+        s->flush();
+        if (conn.fd < 0)
+            conn = accept_now(listener);
+        if (conn.fd >= 0)
+            receive(conn, got);
+        lines = std::size_t(std::count(got.begin(), got.end(), '\n'));
+        return lines >= kept;
+    }),
+        "backlog: kept records arrive");
+    check(lines == kept, "backlog: every kept record arrives once");
+    check(got.size() <= 4096, "backlog: bounded by max_backlog");
+    check(all.starts_with(got), "backlog: oldest records kept, in order");
+    std::filesystem::remove(path);
+}
+
+} // namespace
+
+auto main() -> int
+{
+    unix_stream();
+    tcp_syslog();
+    udp_datagrams();
+    tcp_backoff();
+    bounded_backlog();
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <zappy/details/pattern.hpp>
+
+#include "check.hpp"
+
+// output of pattern_fmt for the placeholders and their specs
+
+namespace {
+
+using namespace std::chrono_literals;
+using zappy_test::check;
+
+auto record(std::string_view logger, zappy::level l, std::string_view message,
+    std::initializer_list<zappy::attribute_view> aa = {}) -> zappy::msg
+{
+    auto m = zappy::msg{l, message, aa};
+    m.logger_name = logger;
+    m.timestamp = zappy::clock::time_point{
+        std::chrono::sys_days{std::chrono::year{2026} / 10 / 19} + 6h + 17min +
+        13s + 123456789ns};
+    return m;
+}
+
+auto format(std::string_view pattern, zappy::msg const& m) -> std::string
+{
+    auto out = std::string{};
+    zappy::pattern_fmt{pattern}.format(out, m);
+    return out;
+}
+
+void default_pattern()
+{
+    auto const p = zappy::pattern_fmt::default_pattern;
+    check(format(p, record("net", zappy::level::info, "up", {{"a", "1"}})) ==
+              "2026-10-19T06:17:13.123Z [net] [info ] up | a=1",
+        "default: with logger");
+    check(format(p, record("", zappy::level::error, "down")) ==
+              "2026-10-19T06:17:13.123Z [error] down",
+        "default: no brackets without logger");
+}
+
+void placeholders()
+{
+    auto const m = record("db", zappy::level::warn, "slow");
+    check(format("{ts:s}", m) == "2026-10-19T06:17:13Z", "ts: seconds");
+    check(format("{ts:ms}", m) == "2026-10-19T06:17:13.123Z", "ts: ms");
+    check(format("{ts:us}", m) == "2026-10-19T06:17:13.123456Z", "ts: us");
+    check(format("{ts:ns}", m) == "2026-10-19T06:17:13.123456789Z",
+        "ts: ns");
+    check(format("{level}|{level:6}|{LEVEL}", m) == "warn|warn  |WARN",
+        "level: width and upper case, a table per placeholder");
+    check(format("{logger}:{msg}", m) == "db:slow", "logger and msg");
+    check(format("{logger:<l>}{msg}", record("", zappy::level::info, "x")) ==
+              "x",
+        "logger: spec left out without logger");
+    check(format("{{{msg}}}", m) == "{slow}", "literal braces");
+    check(format("{msg}", record("a", zappy::level::info, "say \"hi\"\n")) ==
+              "say \\\"hi\\\"\\n",
+        "msg: escaped like to_text");
+}
+
+void attrs()
+{
+    auto ctx = std::make_shared<zappy::details::attr_context>();
+    ctx->attributes.push_back({"tenant", "acme"});
+    ctx->text = " | tenant=acme";
+    auto m = record("db", zappy::level::info, "q", {{"table", "users"}});
+    m.context = ctx;
+
+    check(format("{msg}{attrs}", m) == "q | table=users | tenant=acme",
+        "attrs: default spec, context spliced");
+    check(format("{attrs: k:v}", m) == " table:users tenant:acme",
+        "attrs: custom spec, context rendered with it");
+    check(format("{attrs:[k=v]}/{attrs:(k v)}", m) ==
+              "[table=users][tenant=acme]/(table users)(tenant acme)",
+        "attrs: a spec per placeholder");
+    check(format("{logger:<l>}{attrs}", m) ==
+              "<db> | table=users | tenant=acme",
+        "attrs: default spec after a custom logger spec");
+}
+
+void errors()
+{
+    auto fails = [](std::string_view pattern) {
+        try {
+            zappy::pattern_fmt{pattern};
+        }
+        catch (std::invalid_argument const&) {
+            return true;
+        }
+        return false;
+    };
+    check(fails("{nope}"), "error: unknown placeholder");
+    check(fails("{msg"), "error: unterminated placeholder");
+    check(fails("msg}"), "error: unmatched brace");
+    check(fails("{ts:m}"), "error: timestamp precision");
+    check(fails("{level:x}"), "error: level width");
+    check(fails("{attrs:key}"), "error: attrs spec without v");
+    check(fails("{logger:name}"), "error: logger spec without l");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    default_pattern();
+    placeholders();
+    attrs();
+    errors();
+    return zappy_test::failures ? 1 : 0;
+}
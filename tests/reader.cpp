@@ -0,0 +1,110 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <zappy/details/fmt.hpp>
+#include <zappy/reader.hpp>
+
+#include <unistd.h>
+
+#include "check.hpp"
+
+// searches the same records written as text and as json lines, split over
+// two rotated segments
+
+namespace {
+
+using zappy_test::check;
+
+auto records() -> std::vector<zappy::msg>
+{
+    auto ret = std::vector<zappy::msg>{};
+    auto add = [&](std::string_view logger, zappy::level l,
+                   std::string_view message) -> zappy::msg& {
+        auto& m = ret.emplace_back(l, message);
+        m.logger_name = logger;
+        return m;
+    };
+    for (auto i = 0; i < 3; ++i)
+        add("", zappy::level::error, "disk full");
+    // a logger named like a level
+    for (auto i = 0; i < 2; ++i)
+        add("error", zappy::level::info, "from the error logger");
+    // a message starting like a level
+    for (auto i = 0; i < 2; ++i)
+        add("", zappy::level::info, "[warn] not a warning");
+    add("net", zappy::level::warn, "slow peer").add_attr("peer", "10.0.0.1");
+    add("", zappy::level::critical, "shutting down");
+    return ret;
+}
+
+// writes the records with format into fn and its rotated sibling, returns
+// the path to search
+template <typename Format>
+auto write_log(std::filesystem::path const& dir, std::string const& ext,
+    Format&& format) -> std::filesystem::path
+{
+    auto const all = records();
+    auto line = std::string{};
+    auto older = std::ofstream(dir / ("a.1" + ext), std::ios::binary);
+    auto newer = std::ofstream(dir / ("a" + ext), std::ios::binary);
+    for (std::size_t i = 0; i < all.size(); ++i) {
+        format(line, all[i]);
+        (i < all.size() / 2 ? older : newer) << line << '\n';
+    }
+    return dir / ("a" + ext);
+}
+
+void search(std::filesystem::path const& fn, std::string_view kind)
+{
+    auto const reader = zappy::log_reader{fn};
+    auto count = [&](zappy::level_filter levels,
+                     std::vector<std::string> loggers = {},
+                     std::vector<zappy::attribute> attributes = {}) {
+        auto flt = zappy::read_filter{};
+        flt.levels = std::move(levels);
+        flt.loggers = std::move(loggers);
+        flt.attributes = std::move(attributes);
+        return reader.find(flt, 2).size();
+    };
+    auto only = [](zappy::level l) { return zappy::levels(l, l); };
+    auto what = [&](char const* s) { return std::string(kind) + ": " + s; };
+
+    check(reader.segments().size() == 2, what("rotated segments"));
+    check(count({}) == 9, what("every record"));
+    check(count(only(zappy::level::error)) == 3,
+        what("error level, not the error logger"));
+    check(count(only(zappy::level::warn)) == 1,
+        what("warn level, not a message starting with [warn]"));
+    check(count(zappy::levels(zappy::level::error)) == 4,
+        what("error level and above"));
+    check(count({}, {"error"}) == 2, what("logger named error"));
+    check(count({}, {""}) == 6, what("records without logger"));
+    check(count({}, {"net"}, {{"peer", "10.0.0.1"}}) == 1,
+        what("logger and attribute"));
+    check(count(only(zappy::level::info), {"error"}) == 2,
+        what("level and logger"));
+}
+
+} // namespace
+
+auto main() -> int
+{
+    auto const dir = std::filesystem::temp_directory_path() /
+                     ("zappy-test-reader-" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+
+    search(write_log(dir, ".log",
+               [](std::string& out, zappy::msg const& m) {
+                   zappy::to_text(out, m);
+               }),
+        "text");
+    search(write_log(dir, ".jsonl",
+               [](std::string& out, zappy::msg const& m) {
+                   zappy::to_json(out, m);
+               }),
+        "json");
+
+    std::filesystem::remove_all(dir);
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zappy/details/rotating-file.hpp>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.hpp"
+
+// files left behind by writers that crashed, files shared by several
+// writing processes, and files that cannot be written
+
+namespace {
+
+using zappy_test::check;
+using zappy::details::rotating_file;
+
+auto read_file(std::filesystem::path const& fn) -> std::string
+{
+    auto in = std::ifstream(fn, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+// runs f in a child process that exits without destructors, as if it
+// crashed
+template <typename F>
+auto spawn(F&& f) -> pid_t
+{
+    auto const pid = ::fork();
+    if (pid == 0) {
+        f();
+        ::_exit(0);
+    }
+    return pid;
+}
+
+// waits for a child, returns whether f completed
+auto completed(pid_t pid) -> bool
+{
+    auto status = 0;
+    return pid > 0 && ::waitpid(pid, &status, 0) == pid &&
+           WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+auto lines(char const* prefix, int from, int to) -> std::string
+{
+    auto ret = std::string{};
+    for (auto i = from; i < to; ++i)
+        ret += prefix + std::to_string(i) + "\n";
+    return ret;
+}
+
+// a direct I/O file ends in the zero padding of the last flush when its
+// writer crashed; reopening trims it and appends at the end of the records
+void direct_crash(std::filesystem::path const& dir)
+{
+    auto const fn = dir / "direct.log";
+    auto const pol = rotating_file::policy{
+        .max_size = 1024 * 1024,
+        .max_count = 2,
+        .direct_io = true,
+    };
+    check(completed(spawn([&] {
+        // leaked: never closed, which would trim the padding
+        auto f = new rotating_file{fn, pol};
+        f->write(lines("before ", 0, 100));
+        f->flush();
+    })),
+        "direct: writer crashed");
+    auto const crashed = read_file(fn);
+    // file systems without direct I/O write no padding
+    if (crashed.size() != lines("before ", 0, 100).size())
+        check(crashed.size() % rotating_file::block_size == 0 &&
+                  crashed.back() == '\0',
+            "direct: crash left the padding");
+
+    {
+        auto f = rotating_file{fn, pol};
+        f.write(lines("after ", 0, 100));
+    }
+    auto const got = read_file(fn);
+    check(got.find('\0') == std::string::npos, "direct: no NUL bytes");
+    check(got == lines("before ", 0, 100) + lines("after ", 0, 100),
+        "direct: appended at the end of the records");
+}
+
+// processes appending to one shared file and rotating it: every record
+// ends up whole in one of the segments
+void shared_processes(std::filesystem::path const& dir)
+{
+    auto const fn = dir / "shared.log";
+    auto const processes = 4;
+    auto const records = 5000;
+    auto const text = std::string_view{" the quick brown fox jumps"};
+    auto const pol = rotating_file::policy{
+        .max_size = 32 * 1024,
+        .max_count = 200, // nothing is rotated out
+        .shared = true,
+    };
+    auto pids = std::vector<pid_t>{};
+    for (auto p = 0; p < processes; ++p)
+        pids.push_back(spawn([&, p] {
+            auto f = rotating_file{fn, pol};
+            auto const prefix = "p" + std::to_string(p) + " ";
+            for (auto i = 0; i < records; ++i) {
+                f.write(prefix + std::to_string(i) + std::string(text) + "\n");
+                if (i % 100 == 99)
+                    f.flush();
+            }
+        }));
+    auto ok = true;
+    for (auto pid : pids)
+        ok = completed(pid) && ok;
+    check(ok, "shared: writers completed");
+
+    // the records of every process, oldest segment first
+    auto next = std::vector<int>(processes);
+    auto malformed = 0;
+    auto segments = 0;
+    for (auto i = pol.max_count; i-- > 0;) {
+        auto seg = dir / (i ? "shared." + std::to_string(i) + ".log"
+                            : std::string{"shared.log"});
+        if (!std::filesystem::exists(seg))
+            continue;
+        ++segments;
+        auto in = std::ifstream(seg);
+        for (auto line = std::string{}; std::getline(in, line);) {
+            auto p = 0, n = 0, end = 0;
+            if (std::sscanf(line.c_str(), "p%d %d%n", &p, &n, &end) != 2 ||
+                line.substr(std::size_t(end)) != text || p < 0 ||
+                p >= processes || n != next[p])
+                ++malformed;
+            else
+                ++next[p];
+        }
+    }
+    check(segments > 1, "shared: rotated");
+    check(malformed == 0, "shared: whole records, in order per process");
+    for (auto p = 0; p < processes; ++p)
+        check(next[p] == records, "shared: no records lost");
+}
+
+// writes to a full device fail; what cannot be written is kept for the
+// next write out, up to a buffer, then counted as dropped
+void failing_writes()
+{
+    if (!std::filesystem::exists("/dev/full"))
+        return;
+    auto f = rotating_file{"/dev/full", {.max_size = 0, .max_count = 0}};
+    auto const record = std::string(99, 'x') + "\n";
+    for (auto i = 0; i < 1000; ++i)
+        f.write(record);
+    f.flush();
+    auto const per_buffer =
+        (rotating_file::buffer_size + record.size() - 1) / record.size();
+    check(f.dropped() == per_buffer, "failing: a whole buffer dropped");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    auto const dir = std::filesystem::temp_directory_path() /
+                     ("zappy-test-rotating-file-" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+
+    direct_crash(dir);
+    shared_processes(dir);
+    failing_writes();
+
+    std::filesystem::remove_all(dir);
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/func.hpp>
+
+#include "check.hpp"
+
+// records held back by log_scope: commit, discard, triggers, nesting and
+// pass-through once committed
+
+namespace {
+
+using zappy_test::check;
+using strings = std::vector<std::string>;
+
+// a core whose sink collects the messages it gets
+struct collector {
+    strings got;
+    std::shared_ptr<zappy::core> core = zappy::make_core(zappy::core_options{},
+        {zappy::func_sink(
+            [this](zappy::msg const& m) { got.emplace_back(m.message); },
+            {})});
+    zappy::logger lg{"scope", core};
+
+    // the messages that reached the sink since the last call
+    auto take() -> strings
+    {
+        zappy::core::flush();
+        return std::exchange(got, {});
+    }
+};
+
+void discard()
+{
+    auto c = collector{};
+    {
+        auto s = c.lg.scope();
+        c.lg.info("a");
+        c.lg.warn("b");
+        check(s.size_bytes() > 0, "discard: records held back");
+        check(c.take().empty(), "discard: nothing queued while open");
+    }
+    check(c.take().empty(), "discard: dropped when the scope ends");
+
+    auto s = c.lg.scope();
+    c.lg.info("a");
+    check(!s.commit_if_error(), "discard: commit_if_error without error");
+    check(s.size_bytes() == 0, "discard: buffer truncated");
+    check(c.take().empty(), "discard: commit_if_error dropped them");
+}
+
+void commit()
+{
+    auto c = collector{};
+    auto s = c.lg.scope();
+    c.lg.info("a");
+    c.lg.debug("b");
+    s.commit();
+    check(c.take() == strings{"a", "b"}, "commit: records in order");
+    c.lg.info("c");
+    check(c.take() == strings{"c"}, "commit: later records pass through");
+    s.discard();
+    check(s.size_bytes() == 0, "commit: nothing left to discard");
+}
+
+void trigger()
+{
+    auto c = collector{};
+    {
+        auto s = c.lg.scope();
+        c.lg.info("a", {{"k", "v"}});
+        c.lg.info("b");
+        check(c.take().empty(), "trigger: held back before the error");
+        c.lg.error("c");
+        check(c.take() == strings{"a", "b", "c"},
+            "trigger: held back records first, then the trigger");
+        check(s.failed(), "trigger: scope failed");
+        c.lg.info("d");
+        check(c.take() == strings{"d"}, "trigger: then passed through");
+    }
+
+    // a custom trigger
+    auto s = c.lg.scope(zappy::levels(zappy::level::warn));
+    c.lg.info("e");
+    c.lg.warn("f");
+    check(c.take() == strings{"e", "f"}, "trigger: custom levels");
+    check(!s.failed(), "trigger: a warning does not fail the scope");
+}
+
+void nested()
+{
+    auto c = collector{};
+    {
+        auto outer = c.lg.scope();
+        c.lg.info("o1");
+        {
+            auto inner = c.lg.scope();
+            c.lg.info("i1");
+        }
+        c.lg.info("o2");
+        outer.commit();
+        check(c.take() == strings{"o1", "o2"},
+            "nested: a discarded inner scope drops only its records");
+    }
+    {
+        auto outer = c.lg.scope();
+        c.lg.info("o1");
+        {
+            auto inner = c.lg.scope();
+            c.lg.info("i1");
+            inner.commit();
+            check(c.take() == strings{"i1"},
+                "nested: an inner commit leaves the outer records");
+        }
+    }
+    check(c.take().empty(), "nested: outer records dropped");
+    {
+        auto outer = c.lg.scope();
+        c.lg.info("o1");
+        {
+            auto inner = c.lg.scope();
+            c.lg.info("i1");
+            c.lg.critical("e");
+            check(inner.failed() && outer.failed(),
+                "nested: an error fails the enclosing scopes");
+        }
+        check(c.take() == strings{"o1", "i1", "e"},
+            "nested: a trigger sends the enclosing scopes too");
+        c.lg.info("o2");
+        check(c.take() == strings{"o2"},
+            "nested: the enclosing scope passes through after a trigger");
+    }
+}
+
+// records into other cores and from other threads are not held back
+void pass_through()
+{
+    auto c = collector{};
+    auto other = collector{};
+    auto s = c.lg.scope();
+    other.lg.info("other core");
+    std::thread([&] { c.lg.info("other thread"); }).join();
+    check(other.take() == strings{"other core"}, "pass: other core");
+    check(c.take() == strings{"other thread"}, "pass: other thread");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    discard();
+    commit();
+    trigger();
+    nested();
+    pass_through();
+    return zappy_test::failures ? 1 : 0;
+}
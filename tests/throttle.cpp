@@ -0,0 +1,182 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zappy/logger.hpp>
+#include <zappy/sinks/func.hpp>
+
+#include "check.hpp"
+
+// sampling, duplicate suppression with its summaries, and rate limiting
+
+namespace {
+
+using namespace std::chrono_literals;
+using zappy_test::check;
+
+auto record(std::string_view message, zappy::level l = zappy::level::info)
+    -> zappy::msg
+{
+    auto m = zappy::msg{l, message};
+    m.logger_name = "throttle";
+    return m;
+}
+
+auto admitted(zappy::throttle& t, zappy::msg const& m, int n) -> int
+{
+    auto ret = 0;
+    for (auto i = 0; i < n; ++i)
+        ret += t.admit(m);
+    return ret;
+}
+
+auto repeated(zappy::msg const& m) -> std::string
+{
+    auto ret = std::string{};
+    m.for_each_attr([&](zappy::attribute_view a) {
+        if (a.key == "repeated")
+            ret = a.value;
+    });
+    return ret;
+}
+
+auto summaries(zappy::throttle& t, bool all) -> std::vector<zappy::msg>
+{
+    auto ret = std::vector<zappy::msg>{};
+    t.take_summaries([&](zappy::msg const& m) { ret.push_back(m); }, all);
+    return ret;
+}
+
+void sampling()
+{
+    auto t = zappy::throttle{};
+    check(!t.active(), "sampling: inactive by default");
+    t.sample(zappy::level::info, 4);
+    check(t.active(), "sampling: active once configured");
+    check(admitted(t, record("a"), 100) == 25, "sampling: 1 in 4 info");
+    check(admitted(t, record("a", zappy::level::warn), 10) == 10,
+        "sampling: other levels untouched");
+    t.sample(zappy::level::info, 1);
+    check(!t.active(), "sampling: n of 1 turns it off");
+}
+
+void duplicates()
+{
+    auto t = zappy::throttle{};
+    t.suppress_duplicates(1h);
+    check(admitted(t, record("same"), 10) == 1, "dedupe: first copy only");
+    check(admitted(t, record("other"), 1) == 1, "dedupe: other message");
+    check(admitted(t, record("same", zappy::level::warn), 1) == 1,
+        "dedupe: other level");
+    check(summaries(t, false).empty(), "dedupe: no summary while open");
+
+    auto const s = summaries(t, true);
+    check(s.size() == 1, "dedupe: one summary per window with copies");
+    check(!s.empty() && s[0].message == "same" && repeated(s[0]) == "9",
+        "dedupe: summary counts the copies");
+    check(summaries(t, true).empty(), "dedupe: summaries taken once");
+}
+
+void window_restart()
+{
+    auto t = zappy::throttle{};
+    t.suppress_duplicates(20ms);
+    check(admitted(t, record("again"), 5) == 1, "restart: first window");
+    std::this_thread::sleep_for(30ms);
+    // the record starts a new window, displacing the one that ended
+    check(admitted(t, record("again"), 3) == 1, "restart: second window");
+    auto const s = summaries(t, false);
+    check(s.size() == 1 && repeated(s[0]) == "4",
+        "restart: summary of the displaced window");
+    std::this_thread::sleep_for(30ms);
+    auto const later = summaries(t, false);
+    check(later.size() == 1 && repeated(later[0]) == "2",
+        "restart: summary of the window that ended");
+}
+
+void distinct_messages()
+{
+    auto t = zappy::throttle{};
+    t.suppress_duplicates(1h);
+    auto n = 0;
+    for (auto i = 0; i < 5000; ++i)
+        n += t.admit(record("line " + std::to_string(i)));
+    check(n == 5000, "dedupe: distinct messages all let through");
+    check(summaries(t, true).empty(), "dedupe: nothing to summarize");
+}
+
+void concurrent_duplicates()
+{
+    auto t = zappy::throttle{};
+    t.suppress_duplicates(1h);
+    auto const m = record("racing");
+    auto counts = std::vector<int>(4);
+    auto threads = std::vector<std::thread>{};
+    for (auto& c : counts)
+        threads.emplace_back([&] { c = admitted(t, m, 10000); });
+    for (auto& th : threads)
+        th.join();
+
+    auto let_through = 0;
+    for (auto c : counts)
+        let_through += c;
+    auto const s = summaries(t, true);
+    auto suppressed = 0;
+    for (auto const& r : s)
+        suppressed += std::stoi(repeated(r));
+    check(let_through >= 1 && let_through <= 4,
+        "concurrent: one window, racing starters let through");
+    check(let_through + suppressed == 40000,
+        "concurrent: every copy let through or counted");
+}
+
+void rate_limit()
+{
+    auto t = zappy::throttle{};
+    t.rate_limit(10, 5);
+    check(admitted(t, record("burst"), 20) == 5, "rate: burst of 5");
+    check(admitted(t, record("another"), 20) == 5,
+        "rate: a bucket per message");
+    std::this_thread::sleep_for(250ms);
+    auto const n = admitted(t, record("burst"), 20);
+    check(n >= 2 && n <= 3, "rate: refills at 10 per second");
+
+    auto per_logger = zappy::throttle{};
+    per_logger.rate_limit(10, 3, zappy::throttle_scope::logger);
+    auto both = admitted(per_logger, record("x"), 10);
+    both += admitted(per_logger, record("y"), 10);
+    check(both == 3, "rate: a bucket per logger");
+}
+
+// summaries reach the sinks of a core, in place of the suppressed copies
+void core_summaries()
+{
+    auto got = std::vector<zappy::msg>{};
+    {
+        auto core = zappy::make_core(zappy::core_options{},
+            {zappy::func_sink(
+                [&](zappy::msg const& m) { got.push_back(m); }, {})});
+        core->throttling.suppress_duplicates(1h);
+        auto const lg = zappy::logger{"throttle", core};
+        for (auto i = 0; i < 10; ++i)
+            lg.info("flapping");
+        zappy::core::flush();
+        check(got.size() == 1, "core: copies suppressed");
+    }
+    check(got.size() == 2 && repeated(got[1]) == "9",
+        "core: summary written when the core ends");
+}
+
+} // namespace
+
+auto main() -> int
+{
+    sampling();
+    duplicates();
+    window_restart();
+    distinct_messages();
+    concurrent_duplicates();
+    rate_limit();
+    core_summaries();
+    return zappy_test::failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <zappy/details/record-codec.hpp>
+#include <zappy/details/shm-ring.hpp>
+#include <zappy/sinks/console.hpp>
+#include <zappy/sinks/file.hpp>
+
+namespace {
+
+std::atomic<bool> stop_requested{false};
+
+void on_signal(int) { stop_requested = true; }
+
+void usage(FILE* f)
+{
+    std::fputs(
+        "usage: zappy-collector [options] <shm-name> <output>...\n"
+        "\n"
+        "Reads records written by zappy::shm_sink into the shared memory\n"
+        "ring <shm-name> (e.g. /myapp-log) and writes them to the outputs.\n"
+        "\n"
+        "outputs:\n"
+        "  json:<path>              rotating jsonl file\n"
+        "  text:<path>              rotating text file\n"
+        "  stdout                   console\n"
+        "\n"
+        "options:\n"
+        "  --max-size <bytes>       rotate files at this size\n"
+        "  --max-count <n>          number of rotated files to keep\n"
+        "  --poll-ms <ms>           idle polling interval (default: 10)\n"
+        "  --unlink                 remove the ring on exit\n"
+        "  -h, --help               show this help\n",
+        f);
+}
+
+auto fail(char const* what, std::string_view arg = "") -> int
+{
+    std::fprintf(stderr, "zappy-collector: %s%.*s\n", what, int(arg.size()),
+        arg.data());
+    return 2;
+}
+
+} // namespace
+
+auto main(int argc, char** argv) -> int
+{
+    auto pol = zappy::rotating_file_policy{};
+    auto poll_interval = std::chrono::milliseconds{10};
+    auto unlink_on_exit = false;
+    auto name = std::string{};
+    auto outputs = std::vector<std::string_view>{};
+
+    for (int i = 1; i < argc; ++i) {
+        auto const arg = std::string_view(argv[i]);
+        auto value = [&]() -> char const* {
+            return i + 1 < argc ? argv[++i] : nullptr;
+        };
+        if (arg == "-h" || arg == "--help") {
+            usage(stdout);
+            return 0;
+        }
+        else if (arg == "--unlink") {
+            unlink_on_exit = true;
+        }
+        else if (arg == "--max-size" || arg == "--max-count" ||
+                 arg == "--poll-ms") {
+            auto v = value();
+            if (!v)
+                return fail("missing value for ", arg);
+            auto const n = std::strtoull(v, nullptr, 10);
+            if (arg == "--max-size")
+                pol.max_size = n;
+            else if (arg == "--max-count")
+                pol.max_count = n;
+            else
+                poll_interval = std::chrono::milliseconds(n);
+        }
+        else if (arg.starts_with("-")) {
+            return fail("unknown option: ", arg);
+        }
+        else if (name.empty()) {
+            name = arg;
+        }
+        else {
+            outputs.push_back(arg);
+        }
+    }
+    if (name.empty() || outputs.empty()) {
+        usage(stderr);
+        return 2;
+    }
+
+    auto sinks = std::vector<zappy::sink_ptr>{};
+    for (auto out : outputs) {
+        if (out.starts_with("json:"))
+            sinks.push_back(
+                zappy::rotating_json_file_sink(std::string(out.substr(5)), pol));
+        else if (out.starts_with("text:"))
+            sinks.push_back(
+                zappy::rotating_text_file_sink(std::string(out.substr(5)), pol));
+        else if (out == "stdout")
+            sinks.push_back(zappy::stdout_fd_sink());
+        else
+            return fail("invalid output: ", out);
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    // the producer may start after the collector
+    auto ring = zappy::details::shm_ring{};
+    while (!ring.open(name)) {
+        if (stop_requested)
+            return 0;
+        std::this_thread::sleep_for(poll_interval);
+    }
+
+    auto m = zappy::msg{};
+    auto flushed = true;
+    auto dropped = std::uint64_t{0};
+    auto lost = std::uint64_t{0};
+    while (true) {
+        auto const stopping = stop_requested.load();
+        auto const n = ring.read([&](std::string_view frame) {
+            if (!zappy::details::decode_record(frame, m))
+                return;
+            for (auto const& s : sinks)
+                if (s->accepts(m))
+                    zappy::details::deliver(*s, m);
+        });
+
+        if (n) {
+            flushed = false;
+            continue;
+        }
+        if (!flushed) {
+            for (auto const& s : sinks)
+                zappy::details::flush_sink(*s);
+            flushed = true;
+        }
+        if (auto d = ring.dropped(); d != dropped) {
+            std::fprintf(stderr,
+                "zappy-collector: producer dropped %llu records\n",
+                static_cast<unsigned long long>(d - dropped));
+            dropped = d;
+        }
+        if (auto l = ring.lost(); l != lost) {
+            std::fprintf(stderr,
+                "zappy-collector: skipped %llu bytes of corrupt records\n",
+                static_cast<unsigned long long>(l - lost));
+            lost = l;
+        }
+        if (stopping)
+            break;
+        std::this_thread::sleep_for(poll_interval);
+    }
+
+    ring.close();
+    if (unlink_on_exit)
+        ::shm_unlink(name.c_str());
+}
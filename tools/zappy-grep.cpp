@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zappy/reader.hpp>
+
+namespace {
+
+void usage(FILE* f)
+{
+    std::fputs(
+        "usage: zappy-grep [options] <file>...\n"
+        "\n"
+        "Searches zappy jsonl/text logs, including rotated name.N.ext\n"
+        "segments, and prints matching lines in timestamp order.\n"
+        "\n"
+        "options:\n"
+        "  -l, --level <level>      minimum level (debug..critical)\n"
+        "  -L, --logger <name>      logger name, may be repeated\n"
+        "  -s, --since <timestamp>  inclusive lower bound (prefix allowed)\n"
+        "  -u, --until <timestamp>  exclusive upper bound (prefix allowed)\n"
+        "  -a, --attr <key=value>   attribute equality, may be repeated\n"
+        "  -j, --jobs <n>           number of threads (default: all cores)\n"
+        "  -c, --count              print the number of matches only\n"
+        "  -h, --help               show this help\n",
+        f);
+}
+
+auto fail(char const* what, std::string_view arg = "") -> int
+{
+    std::fprintf(stderr, "zappy-grep: %s%.*s\n", what, int(arg.size()),
+        arg.data());
+    return 2;
+}
+
+} // namespace
+
+auto main(int argc, char** argv) -> int
+{
+    auto flt = zappy::read_filter{};
+    auto files = std::vector<std::filesystem::path>{};
+    auto jobs = 0u;
+    auto count_only = false;
+
+    for (int i = 1; i < argc; ++i) {
+        auto const arg = std::string_view(argv[i]);
+        auto is = [&](char const* short_opt, char const* long_opt) {
+            return arg == short_opt || arg == long_opt;
+        };
+        auto value = [&]() -> char const* {
+            return i + 1 < argc ? argv[++i] : nullptr;
+        };
+
+        if (is("-h", "--help")) {
+            usage(stdout);
+            return 0;
+        }
+        else if (is("-c", "--count")) {
+            count_only = true;
+        }
+        else if (is("-l", "--level")) {
+            auto v = value();
+            auto l = zappy::level::info;
+            if (!v || !zappy::from_sv(v, l))
+                return fail("invalid level: ", v ? v : "");
+            flt.levels = zappy::levels(l);
+        }
+        else if (is("-L", "--logger")) {
+            auto v = value();
+            if (!v)
+                return fail("missing logger name");
+            flt.loggers.emplace_back(v);
+        }
+        else if (is("-s", "--since")) {
+            auto v = value();
+            if (!v)
+                return fail("missing timestamp");
+            flt.since = v;
+        }
+        else if (is("-u", "--until")) {
+            auto v = value();
+            if (!v)
+                return fail("missing timestamp");
+            flt.until = v;
+        }
+        else if (is("-a", "--attr")) {
+            auto v = value();
+            auto const kv = std::string_view(v ? v : "");
+            auto const eq = kv.find('=');
+            if (eq == std::string_view::npos)
+                return fail("invalid attribute, expected key=value: ", kv);
+            flt.attributes.emplace_back(kv.substr(0, eq), kv.substr(eq + 1));
+        }
+        else if (is("-j", "--jobs")) {
+            auto v = value();
+            if (!v || !(jobs = unsigned(std::strtoul(v, nullptr, 10))))
+                return fail("invalid number of jobs");
+        }
+        else if (arg.starts_with("-") && arg.size() > 1) {
+            return fail("unknown option: ", arg);
+        }
+        else {
+            files.emplace_back(arg);
+        }
+    }
+
+    if (files.empty()) {
+        usage(stderr);
+        return 2;
+    }
+
+    auto reader = zappy::log_reader{files};
+    auto const lines = reader.find(flt, jobs);
+
+    if (count_only) {
+        std::printf("%zu\n", lines.size());
+    }
+    else {
+        for (auto const& l : lines) {
+            std::fwrite(l.text.data(), 1, l.text.size(), stdout);
+            std::fputc('\n', stdout);
+        }
+    }
+    return lines.empty() ? 1 : 0;
+}